@@ -12,5 +12,8 @@
 #include <sysclib.h>
 #include <thbase.h>
 #include <thevent.h>
+#ifdef SMAP_TRACE
+#include <timrman.h>
+#endif
 
 #endif /* IOP_IRX_IMPORTS_H */
@@ -14,6 +14,8 @@
 
 #include <ps2ip.h>
 
+#include <smapregs.h>
+
 #include "main.h"
 
 #define dbgprintf(args...) DEBUG_PRINTF(args)
@@ -28,8 +30,47 @@ typedef struct netif	NetIF;
 typedef struct SMapIF	SMapIF;
 typedef struct pbuf	PBuf;
 
-static struct pbuf *TxHead, *TxTail;
-static void EnQTxPacket(struct pbuf *tx);
+/*	Non-Sony: frames are queued as pbuf chains, so the queue cannot be linked through the next fields of the pbufs.
+	The tcpip-thread is the only producer and the interrupt handler thread is the only consumer, so the queue is a single-producer/single-consumer ring:
+	TxQueueHead is only written by the producer and TxQueueTail only by the consumer, hence no interrupts need to be suspended.
+	There is one ring for each Tx priority class (see SMapTxClassify()). Frames of a higher class are always sent first.
+	Must be a power of 2.	*/
+#define SMAP_TX_QUEUE_SIZE	64
+
+/*	The IOP has a single in-order CPU, hence the threads can only see each other's stores in program order.
+	A compiler barrier is enough to ensure that a ring entry is written before the index that publishes it.	*/
+#define SMAP_BARRIER()	__asm volatile("" ::: "memory")
+
+static struct pbuf *TxQueue[SMAP_TX_CLASSES][SMAP_TX_QUEUE_SIZE];
+static volatile unsigned int TxQueueHead[SMAP_TX_CLASSES], TxQueueTail[SMAP_TX_CLASSES];
+static unsigned int TxQueueCurrentClass;	//Class of the frame last returned by SMapTxPacketNext().
+
+/*	Non-Sony: byte queue limit, in the spirit of Linux BQL.
+	The number of bytes queued is bounded, so that a frame does not have to wait behind more than roughly TxLatency milliseconds worth of data.
+	Every class except SMAP_TX_CLASS_CONTROL is limited, so that no kind of traffic (e.g. UDP) can fill the queue and delay everything behind it.
+	ARP frames are few and small, and are never refused because of the limit.
+	Unlike Linux, the driver cannot stop the stack's queue. It can only refuse a frame with ERR_MEM, which is passed up to the sender.
+	TCP copes with that: since lwIP 1.4.0, tcp_output() leaves a segment that could not be sent on the unsent list and retries it
+	on the next fast timer tick (TF_NAGLEMEMERR). Earlier versions only send it again after a retransmission timeout.
+	For UDP, udp_send() returns ERR_MEM to the application, as it does when the queue is full.
+	The producer adds to TxQueueBytesIn and the consumer to TxQueueBytesOut, so each counter has a single writer, like the ring indices.
+	The limit is derived from the rate at which the consumer drains the queue. It is raised right away if the queue ran dry while the stack was being pushed back. */
+#define SMAP_TX_QUEUE_LIMIT_MIN	(8*1514)
+#define SMAP_TX_QUEUE_LIMIT_MAX	(SMAP_TX_QUEUE_SIZE*1514)
+
+static volatile u32 TxQueueBytesIn, TxQueueBytesOut;
+static volatile u32 TxQueueLimit = SMAP_TX_QUEUE_LIMIT_MAX;
+static volatile unsigned char TxQueueStopped;	//Written by the producer: the last frame was refused because of the limit.
+static unsigned char TxQueueStarved;		//Written by the consumer: the queue ran dry while the producer was stopped.
+static u32 TxQueueLastBytesOut;
+static iop_sys_clock_t TxQueueLastUpdate;
+static int EnQTxPacket(struct pbuf *tx, unsigned int class);
+static int SMapIsTxFlushHint(PBuf* pOutput);
+static unsigned int SMapTxClassify(PBuf* pOutput);
+static int SMapTxQueueIsEmpty(void);
+
+extern struct SmapDriverData SmapDriverData;
+extern struct irx_export_table _exp_smap;
 
 static NetIF	NIF;
 
@@ -53,26 +94,55 @@ static err_t
 SMapLowLevelOutput(NetIF* pNetIF,PBuf* pOutput)
 {
 	err_t result;
-	struct pbuf* pbuf;
+	int depth;
+	unsigned int class;
 
 #if USE_GP_REGISTER
 	SaveGP();
 #endif
 
-	result = ERR_OK;
-	if(pOutput->tot_len > pOutput->len)
+	//Do not queue frames while there is no link, as the queue is only emptied by the interrupt handler thread.
+	if(!SmapDriverData.LinkStatus)
+	{
+#if USE_GP_REGISTER
+		RestoreGP();
+#endif
+		return ERR_CONN;
+	}
+
+	//If nothing is queued, try to write the frame into the Tx FIFO right away. The frame is copied before this returns, so no reference is taken.
+	if(SMapTxQueueIsEmpty() && SMAPXmitDirect(pOutput) == 0)
+	{
+#if USE_GP_REGISTER
+		RestoreGP();
+#endif
+		return ERR_OK;
+	}
+
+	class = SMapTxClassify(pOutput);
+
+	//Push back on the sender if the byte queue limit has been reached. The frame that crosses the limit is still queued.
+	if(class != SMAP_TX_CLASS_CONTROL && SmapDriverData.TxLatency != 0 && TxQueueBytesIn - TxQueueBytesOut >= TxQueueLimit)
 	{
-		pbuf_ref(pOutput);	//Increment reference count because LWIP must free the PBUF, not the driver!
-		if((pbuf = pbuf_coalesce(pOutput, PBUF_RAW)) != pOutput)
-		{	//No need to increase reference count because pbuf_coalesce() does it.
-			EnQTxPacket(pbuf);
-			SMAPXmit();
-		} else
-			result = ERR_MEM;
+		TxQueueStopped = 1;
+		SmapDriverData.RuntimeStats.TxQueueLimitCount++;
+#if USE_GP_REGISTER
+		RestoreGP();
+#endif
+		return ERR_MEM;
+	}
+
+	//Chained pbufs are not coalesced, as HandleTxReqs() will write every segment of the chain into the Tx FIFO.
+	pbuf_ref(pOutput);	//Increment reference count because LWIP must free the PBUF, not the driver!
+	if((depth = EnQTxPacket(pOutput, class)) >= 0)
+	{
+		/*	Only wake the driver up if the queue of this class was empty (it will drain everything queued after that), or if the stack is done with a burst.
+			A frame of a higher class hence always wakes the driver up, even if it is still busy with bulk data. */
+		SMAPXmit(depth == 0 || SMapIsTxFlushHint(pOutput));
+		result = ERR_OK;
 	} else {
-		pbuf_ref(pOutput);	//This will be freed later.
-		EnQTxPacket(pOutput);
-		SMAPXmit();
+		pbuf_free(pOutput);
+		result = ERR_MEM;
 	}
 
 #if USE_GP_REGISTER
@@ -110,6 +180,41 @@ SMapOutput(NetIF* pNetIF,PBuf* pOutput,IPAddr* pIPAddr)
 }
 #endif
 
+#if LWIP_IGMP
+//SMapIgmpMacFilter():
+
+//Called by the stack when an IPv4 multicast group is joined or left. Maps the group to its Ethernet address and updates the multicast filter.
+
+static err_t SMapIgmpMacFilter(NetIF* pNetIF, const IPAddr* pGroup, enum netif_mac_filter_action action)
+{
+	const u8 *group;
+	u8 address[6];
+
+#if USE_GP_REGISTER
+	SaveGP();
+#endif
+
+	group=(const u8*)&pGroup->addr;
+	address[0]=0x01;
+	address[1]=0x00;
+	address[2]=0x5E;
+	address[3]=group[1]&0x7F;
+	address[4]=group[2];
+	address[5]=group[3];
+
+	if(action==NETIF_ADD_MAC_FILTER)
+		SMapMulticastAdd(address);
+	else
+		SMapMulticastDel(address);
+
+#if USE_GP_REGISTER
+	RestoreGP();
+#endif
+
+	return ERR_OK;
+}
+#endif
+
 //SMapIFInit():
 
 //Should be called at the beginning of the program to set up the network interface.
@@ -121,8 +226,8 @@ SMapIFInit(NetIF* pNetIF)
 	SaveGP();
 #endif
 
-	TxHead = NULL;
-	TxTail = NULL;
+	bzero((void*)TxQueueHead, sizeof(TxQueueHead));
+	bzero((void*)TxQueueTail, sizeof(TxQueueTail));
 
 	pNetIF->name[0]=IFNAME0;
 	pNetIF->name[1]=IFNAME1;
@@ -139,6 +244,17 @@ SMapIFInit(NetIF* pNetIF)
 	pNetIF->flags|=(NETIF_FLAG_ETHARP|NETIF_FLAG_BROADCAST);	// For LWIP v1.3.0 and later.
 #endif
 	pNetIF->mtu=1500;
+#if LWIP_IGMP
+	//Non-Sony: let the EMAC3 filter multicast frames by the groups joined.
+	pNetIF->flags|=NETIF_FLAG_IGMP;
+	pNetIF->igmp_mac_filter=&SMapIgmpMacFilter;
+#endif
+#if LWIP_CHECKSUM_CTRL_PER_NETIF
+	/*	Non-Sony: the driver verifies the IPv4 header and TCP checksums of received frames while copying them, so the stack need not do so again.
+		IPv4 frames that the driver cannot verify are dropped instead of being passed on (see SMapRxChecksumCheck()). UDP is still verified by the stack. */
+	if(SmapDriverData.EnableRxChecksum)
+		NETIF_SET_CHECKSUM_CTRL(pNetIF, NETIF_CHECKSUM_ENABLE_ALL & ~(NETIF_CHECKSUM_CHECK_IP|NETIF_CHECKSUM_CHECK_TCP));
+#endif
 
 	//Get MAC address.
 	SMAPGetMACAddress(pNetIF->hwaddr);
@@ -155,75 +271,241 @@ SMapIFInit(NetIF* pNetIF)
 	return	ERR_OK;
 }
 
-void SMapLowLevelInput(PBuf* pBuf)
+//SMapInputBatch():
+
+//Delivers a list of received frames to the stack. It'll be invoked in the context of the tcpip-thread.
+
+static void SMapInputBatch(void *arg)
+{
+	PBuf *pBuf, *pNext;
+
+#if USE_GP_REGISTER
+	SaveGP();
+#endif
+
+	for(pBuf=(PBuf*)arg; pBuf!=NULL; pBuf=pNext)
+	{
+		pNext=pBuf->next;
+		pBuf->next=NULL;
+
+		if(ethernet_input(pBuf,&NIF)!=ERR_OK)
+			pbuf_free(pBuf);
+	}
+
+#if USE_GP_REGISTER
+	RestoreGP();
+#endif
+}
+
+int SMapLowLevelInput(PBuf* pBuf)
 {
-	//When we receive data, the interrupt-handler will invoke this function, which means we are in an interrupt-context. Pass on
-	//the received data to ps2ip.
+	PBuf *pNext;
+
+	//When we receive data, the interrupt-handler thread will invoke this function with every frame that was received in one pass.
+	//The frames are linked through their next fields (each frame is a single pbuf, see SMapRxBufferGet()). Pass the whole list on to ps2ip with a single message.
+
+	if(tcpip_callback_with_block(&SMapInputBatch, pBuf, 0)!=ERR_OK)
+	{
+		//The tcpip-thread's mailbox is full. Drop the frames.
+		for(; pBuf!=NULL; pBuf=pNext)
+		{
+			pNext=pBuf->next;
+			pBuf->next=NULL;
+			pbuf_free(pBuf);
+		}
+
+		return -1;
+	}
 
-	ps2ip_input(pBuf,&NIF);
+	return 0;
 }
 
-static void EnQTxPacket(struct pbuf *tx)
+//SMapIsTxFlushHint():
+
+//Returns non-zero if the frame is a TCP segment with PSH or FIN set. lwIP sets PSH on the last segment of each write,
+//which makes it a hint that no further frames will follow for now.
+
+static int SMapIsTxFlushHint(PBuf* pOutput)
 {
-	int OldState;
+	const u8 *frame;
+	unsigned int IPHeaderLength;
 
-	CpuSuspendIntr(&OldState);
+	frame = pOutput->payload;
+	if(pOutput->len < 14 + 20 || frame[12] != 0x08 || frame[13] != 0x00 || frame[14 + 9] != 6)	//IPv4, TCP
+		return 0;
 
-	if(TxHead != NULL)
-		TxHead->next = tx;
+	IPHeaderLength = (frame[14] & 0xF) * 4;
+	if(pOutput->len < 14 + IPHeaderLength + 14)
+		return 0;
+
+	return((frame[14 + IPHeaderLength + 13] & 0x09) != 0);	//TCP_PSH | TCP_FIN
+}
 
-	TxHead = tx;
-	tx->next = NULL;
+//SMapTxClassify():
+
+//Returns the Tx priority class of a frame: ARP frames and TCP segments that only acknowledge data are sent ahead of everything else,
+//so that they do not wait behind full-sized segments. Segments with SYN, FIN or RST are kept in order with the data.
+
+static unsigned int SMapTxClassify(PBuf* pOutput)
+{
+	const u8 *frame;
+	unsigned int IPHeaderLength, TCPHeaderLength;
 
-	if(TxTail == NULL)	//Queue empty
-		TxTail = TxHead;
+	frame = pOutput->payload;
+	if(pOutput->len < 14)
+		return SMAP_TX_CLASS_BULK;
 
-	CpuResumeIntr(OldState);
+	if(frame[12] == 0x08 && frame[13] == 0x06)	//ARP
+		return SMAP_TX_CLASS_CONTROL;
+
+	if(pOutput->len < 14 + 20 || frame[12] != 0x08 || frame[13] != 0x00 || frame[14 + 9] != 6)	//IPv4, TCP
+		return SMAP_TX_CLASS_BULK;
+
+	IPHeaderLength = (frame[14] & 0xF) * 4;
+	if(pOutput->len < 14 + IPHeaderLength + 20)
+		return SMAP_TX_CLASS_BULK;
+
+	TCPHeaderLength = (frame[14 + IPHeaderLength + 12] >> 4) * 4;
+	if((frame[14 + 2] << 8 | frame[14 + 3]) == IPHeaderLength + TCPHeaderLength	//No data
+		&& (frame[14 + IPHeaderLength + 13] & 0x07) == 0)	//TCP_FIN | TCP_SYN | TCP_RST
+		return SMAP_TX_CLASS_ACK;
+
+	return SMAP_TX_CLASS_BULK;
 }
 
-int SMapTxPacketNext(void **payload)
+static int SMapTxQueueIsEmpty(void)
 {
-	int len;
+	unsigned int class;
 
-	if(TxTail != NULL)
+	for(class = 0; class < SMAP_TX_CLASSES; class++)
 	{
-		*payload = TxTail->payload;
-		len = TxTail->len;
-	} else
-		len = 0;
+		if(TxQueueHead[class] != TxQueueTail[class])
+			return 0;
+	}
 
-	return len;
+	return 1;
 }
 
-void SMapTxPacketDeQ(void)
+//Producer side of the Tx queue. Must only be called from the tcpip-thread.
+//Returns the number of frames that were queued in the same class before this one, or -1 if the queue is full.
+static int EnQTxPacket(struct pbuf *tx, unsigned int class)
 {
-	struct pbuf *toFree;
-	int OldState;
+	unsigned int head, depth;
 
-	toFree = NULL;
+	head = TxQueueHead[class];
+	depth = head - TxQueueTail[class];
+	if(depth >= SMAP_TX_QUEUE_SIZE)
+	{
+		SmapDriverData.RuntimeStats.TxQueueFullCount++;
+		return -1;	//Queue full
+	}
 
-	CpuSuspendIntr(&OldState);
-	if(TxTail != NULL)
+	TxQueue[class][head % SMAP_TX_QUEUE_SIZE] = tx;
+	if(class != SMAP_TX_CLASS_CONTROL)
 	{
-		toFree = TxTail;
-
-		if(TxTail == TxHead) {
-			//Last in queue.
-			TxTail = NULL;
-			TxHead = NULL;
-		} else {
-			TxTail = TxTail->next;
+		TxQueueBytesIn += tx->tot_len;
+		TxQueueStopped = 0;
+	}
+	SMAP_BARRIER();
+	TxQueueHead[class] = head + 1;
+	SmapDriverData.RuntimeStats.TxClassFrameCount[class]++;
+
+	if(depth + 1 > SmapDriverData.RuntimeStats.TxQueueHighWater)
+		SmapDriverData.RuntimeStats.TxQueueHighWater = depth + 1;
+
+	return depth;
+}
+
+//Consumer side of the Tx queue: returns the frame at the front of the highest non-empty class and its total length, or 0 if the queue is empty.
+int SMapTxPacketNext(struct pbuf **pbuf)
+{
+	unsigned int class, tail;
+
+	for(class = 0; class < SMAP_TX_CLASSES; class++)
+	{
+		tail = TxQueueTail[class];
+		if(tail != TxQueueHead[class])
+		{
+			SMAP_BARRIER();
+			TxQueueCurrentClass = class;
+			*pbuf = TxQueue[class][tail % SMAP_TX_QUEUE_SIZE];
+			return (*pbuf)->tot_len;
 		}
 	}
-	CpuResumeIntr(OldState);
 
-	if(toFree != NULL)
+	return 0;
+}
+
+//Consumer side of the Tx queue: removes the frame that was last returned by SMapTxPacketNext().
+void SMapTxPacketDeQ(void)
+{
+	struct pbuf *toFree;
+	unsigned int class, tail;
+
+	class = TxQueueCurrentClass;
+	tail = TxQueueTail[class];
+	if(tail != TxQueueHead[class])
 	{
-		toFree->next = NULL;
+		SMAP_BARRIER();
+		toFree = TxQueue[class][tail % SMAP_TX_QUEUE_SIZE];
+		SMAP_BARRIER();
+		TxQueueTail[class] = tail + 1;
+
+		if(class != SMAP_TX_CLASS_CONTROL)
+		{
+			TxQueueBytesOut += toFree->tot_len;
+			if(TxQueueBytesOut == TxQueueBytesIn && TxQueueStopped)
+				TxQueueStarved = 1;
+		}
+
 		pbuf_free(toFree);
 	}
 }
 
+//Consumer side of the Tx queue: recalculates the byte queue limit and samples the queue depths. Called periodically by the interrupt handler thread.
+void SMapTxQueueLimitUpdate(void)
+{
+	iop_sys_clock_t now, elapsed;
+	u32 sec, usec, ms, BytesOut, limit;
+	unsigned int class;
+
+	GetSystemTime(&now);
+	//Subtract all 64 bits, borrowing from the high word if the low word has wrapped around since the last update.
+	elapsed.lo = now.lo - TxQueueLastUpdate.lo;
+	elapsed.hi = now.hi - TxQueueLastUpdate.hi - (now.lo < TxQueueLastUpdate.lo);
+	TxQueueLastUpdate = now;
+	SysClock2USec(&elapsed, &sec, &usec);
+	ms = sec * 1000 + usec / 1000;
+
+	BytesOut = TxQueueBytesOut;
+	if(ms > 0)
+		limit = (BytesOut - TxQueueLastBytesOut) / ms * SmapDriverData.TxLatency;
+	else
+		limit = TxQueueLimit;
+	TxQueueLastBytesOut = BytesOut;
+
+	if(TxQueueStarved)
+	{
+		//The limit was too low to keep the driver busy.
+		SmapDriverData.RuntimeStats.TxQueueStarvedCount++;
+		if(limit < TxQueueLimit + TxQueueLimit / 2)
+			limit = TxQueueLimit + TxQueueLimit / 2;
+		TxQueueStarved = 0;
+	}
+
+	if(limit < SMAP_TX_QUEUE_LIMIT_MIN)
+		limit = SMAP_TX_QUEUE_LIMIT_MIN;
+	else if(limit > SMAP_TX_QUEUE_LIMIT_MAX)
+		limit = SMAP_TX_QUEUE_LIMIT_MAX;
+	TxQueueLimit = limit;
+
+	SmapDriverData.RuntimeStats.TxQueueLimit = limit;
+	SmapDriverData.RuntimeStats.TxQueueBytes = TxQueueBytesIn - BytesOut;
+
+	for(class = 0; class < SMAP_TX_CLASSES; class++)
+		SmapDriverData.RuntimeStats.TxClassDepth[class] = TxQueueHead[class] - TxQueueTail[class];
+}
+
 static inline int SMapInit(IPAddr *IP, IPAddr *NM, IPAddr *GW, int argc, char *argv[])
 {
 	if(smap_init(argc, argv)!=0)
@@ -268,6 +550,13 @@ int _start(int argc, char *argv[])
 
 	DisplayBanner();
 
+	//Non-Sony: export the "smap" library (see ps2smap.h). This also prevents the driver from being loaded twice.
+	if(RegisterLibraryEntries(&_exp_smap) != 0)
+	{
+		printf("smap: module already loaded\n");
+		return MODULE_NO_RESIDENT_END;
+	}
+
 /*	This code was present in SMAP, but cannot be implemented with the default IOP kernel due to MODLOAD missing these functions.
 	It may be necessary to prevent SMAP from linking with an old DEV9 module.
 	if((ModuleID=SearchModuleByName("dev9"))<0)
@@ -316,6 +605,7 @@ int _start(int argc, char *argv[])
 	{
 
 		//Something went wrong, return 1 to indicate failure.
+		ReleaseLibraryEntries(&_exp_smap);
 		return MODULE_NO_RESIDENT_END;
 	}
 
@@ -15,6 +15,14 @@
 	__asm volatile("move $gp, %0" :: "r"(_ori_gp) : "gp")
 #endif
 
+#include "ps2smap.h"
+
+/* Tx priority classes, highest first. */
+#define SMAP_TX_CLASS_CONTROL	0	//ARP
+#define SMAP_TX_CLASS_ACK	1	//TCP segments without data
+#define SMAP_TX_CLASS_BULK	2	//Everything else
+#define SMAP_TX_CLASSES		SMAP_STATS_TX_CLASSES
+
 struct RuntimeStats{
 	u32 RxDroppedFrameCount;
 	u32 RxErrorCount;
@@ -29,16 +37,89 @@ struct RuntimeStats{
 	u16 TxFrameCollisionCount;
 	u16 TxFrameUnderrunCount;
 	u16 RxAllocFail;
+	u16 RxRingEmpty;
+	u32 RxBatchCount;
+	u32 RxBatchFrameCount;
+	u16 RxBatchMax;
+	u16 RxPollModeCount;
+	u16 TxQueueHighWater;
+	u16 TxQueueFullCount;
+	u32 TxKickCount;
+	u32 TxKickSkippedCount;
+	u32 TxDirectCount;
+	//Reads across the DEV9 bus (registers and BDs, excluding FIFO data), for comparing against the number of frames.
+	u32 RxBusReadCount;
+	u32 TxBusReadCount;
+	u32 TxFrameCount;	//Frames reclaimed from the Tx BDs.
+	u32 TxEndIntrCount;
+	//Byte queue limit of the Tx queue, as of the last update.
+	u32 TxQueueBytes;
+	u32 TxQueueLimit;
+	u32 TxQueueLimitCount;	//Frames refused because of the limit.
+	u32 TxQueueStarvedCount;	//Times the queue ran dry while frames were being refused.
+	u32 TxClassFrameCount[SMAP_TX_CLASSES];	//Frames queued in each Tx priority class.
+	u16 TxClassDepth[SMAP_TX_CLASSES];	//Frames waiting in each Tx priority class, as of the last update.
+	u32 RxCsumOkCount;	//TCP segments whose checksum was verified by the driver.
+	u32 RxCsumBadCount;	//Frames dropped because of a malformed IPv4 header, or a bad IPv4 header or TCP checksum.
+	u32 RxFilterDropCount;	//Frames dropped by the early Rx filter.
+	u32 RxPauseIntrCount;	//EMAC3 interrupts with pause frames received. Several pause frames may be received per interrupt.
+	u32 RxPauseFrameDropCount;	//Pause frames that were stored in the Rx FIFO and discarded.
+	//EMAC3 Tx threshold and Rx high watermark in bytes, and the number of times that -autotune has changed them.
+	u16 TxThreshold;
+	u16 RxHiWater;
+	u16 TxThresholdChangeCount;
+	u16 RxHiWaterChangeCount;
+	u32 RxFrameCount;	//Frames handed over to ps2ip.
+	u32 RxByteCount;
+	u32 TxByteCount;	//Bytes written into the Tx FIFO, excluding padding.
+	//Bytes moved through the FIFOs, including padding, and how many of them were moved with DMA.
+	u32 RxFifoByteCount;
+	u32 RxDmaByteCount;
+	u32 TxFifoByteCount;
+	u32 TxDmaByteCount;
+	u32 RxFrameSizeHist[SMAP_STATS_SIZE_BUCKETS];
+	u32 TxFrameSizeHist[SMAP_STATS_SIZE_BUCKETS];
+	u32 RxLatencyHist[SMAP_STATS_LATENCY_BUCKETS];
+	u32 RxCsumFragDropCount;	//Fragments of TCP segments dropped because their checksum cannot be verified.
 };
 
+/*	Number of pre-allocated Rx buffers owned by the driver. Must be a power of 2.
+	Each entry holds a PBUF_POOL buffer, so this should be kept well below PBUF_POOL_SIZE of ps2ip.	*/
+#define SMAP_RX_RING_SIZE	8
+//Largest frame (FCS stripped by the EMAC3), rounded up to a multiple of 4. Larger frames bypass the ring.
+#define SMAP_RX_FRAME_MAX	((1514+3)&~3)
+//Range of DMA block sizes, as log2 of the size in bytes.
+#define SMAP_DMA_SLICE_SHIFT_MIN	5
+#define SMAP_DMA_SLICE_SHIFT_MAX	8
+//Size of the Rx buffers when Rx DMA padding is enabled: the last DMA block of a frame may overrun the frame by up to one block.
+#define SMAP_RX_BUFFER_SIZE	((SMAP_RX_FRAME_MAX+(1<<SMAP_DMA_SLICE_SHIFT_MAX)-1)&~((1<<SMAP_DMA_SLICE_SHIFT_MAX)-1))
+
 struct SmapDriverData{
 	volatile u8 *smap_regbase;
 	volatile u8 *emac3_regbase;
 	unsigned int TxBufferSpaceAvailable;
+	u16 TxFifoWrPtr;		//Tx FIFO write pointer, relative to SMAP_TX_BASE.
+	u16 TxDmaPadMin;		//Smallest frame whose Tx FIFO write is padded to whole DMA blocks. 0 = disabled.
+	u16 RxDmaPadMin;		//Smallest frame whose Rx FIFO read is padded to whole DMA blocks. 0 = disabled.
+	u16 DmaMin;			//Smallest FIFO transfer to use DMA for, in bytes.
+	unsigned char DmaSliceShift;	//log2 of the DMA block size, in bytes.
+	unsigned char EnableRxChecksum;	//Verify the IPv4 header and TCP checksums of received frames, in place of the stack.
+	u16 TxLatency;			//Target latency of the Tx queue, in milliseconds. 0 = no byte queue limit.
+	unsigned char TxThreshold;	//EMAC3 Tx threshold, in units of 64 bytes less one.
+	u16 RxHiWater;			//EMAC3 Rx high watermark, in units of 8 bytes.
+	//State of -autotune: error counts as of the last tick, and ticks without errors.
+	u16 AutoTuneTxUnderruns;
+	u16 AutoTuneRxOverruns;
+	unsigned char AutoTuneTxQuiet;
+	unsigned char AutoTuneRxQuiet;
+	u16 TxBDSize[SMAP_BD_MAX_ENTRY];	//Tx FIFO space used by the frame of each Tx BD, including padding.
 	unsigned char NumPacketsInTx;
 	unsigned char TxBDIndex;
 	unsigned char TxDNVBDIndex;
 	unsigned char RxBDIndex;
+	unsigned char RxRingIndex;	//Next pre-allocated Rx buffer to be consumed.
+	unsigned char RxRingFillIndex;	//Next Rx ring slot to be refilled.
+	unsigned char RxRingDisabled;	//The pool buffers are too small for a whole frame, so the ring is bypassed.
 	void *packetToSend;
 	int Dev9IntrEventFlag;
 	int IntrHandlerThreadID;
@@ -48,16 +129,57 @@ struct SmapDriverData{
 	unsigned char EnableLinkCheckTimer;
 	unsigned char LinkStatus;		//Ethernet link is initialized (hardware)
 	unsigned char LinkMode;
+	unsigned char RxPolling;		//RXEND is masked and the Rx FIFO is being polled.
+	volatile unsigned char TxLock;		//A thread owns the Tx FIFO and Tx BDs.
+	volatile unsigned char TxLockContended;	//Another thread tried to take TxLock while it was held.
 	iop_sys_clock_t LinkCheckTimer;
+	iop_sys_clock_t PhyTimer;
+	unsigned char PhyState;		//State of the PHY state machine, SMAP_PHY_STATE_*.
+	unsigned char PhyRetries;	//Auto-negotiation attempts.
+	u16 PhyPolls;			//Link polls in the current state.
+	unsigned char LinkRecovering;	//The link came back, but no frame has been received since.
+	unsigned char WakeupTimeValid;	//WakeupTime is when the driver thread woke up for an interrupt, and no frames have been received since.
+	iop_sys_clock_t WakeupTime;
+	struct SmapLinkStats LinkStats;
+	struct pbuf *RxRing[SMAP_RX_RING_SIZE];
+	unsigned char RxFilterCount;	//Number of Rx filter rules in use.
+	unsigned char RxFilterFields;	//Fields matched on by the Rx filter rules in use.
+	struct SmapRxFilterRule RxFilter[SMAP_RX_FILTER_MAX];
+	u32 RxFilterHits[SMAP_RX_FILTER_MAX];
+	u16 McastHashRef[64];		//Number of multicast addresses that use each bit of the EMAC3 group hash.
 	struct RuntimeStats RuntimeStats;
 };
 
+/* Non-Sony: trace points of the hot paths, only compiled in with SMAP_TRACE=1. The stages are listed in ps2smap.h. */
+#ifdef SMAP_TRACE
+void SMapTrace(unsigned int stage, unsigned int arg);
+#define SMAP_TRACE_POINT(stage, arg)	SMapTrace(stage, arg)
+#else
+#define SMAP_TRACE_POINT(stage, arg)
+#endif
+
 /* Event flag bits */
 #define SMAP_EVENT_START	0x01
 #define SMAP_EVENT_STOP		0x02
 #define SMAP_EVENT_INTR		0x04
 #define SMAP_EVENT_XMIT		0x08
 #define SMAP_EVENT_LINK_CHECK	0x10
+#define SMAP_EVENT_PHY		0x20	//Non-Sony: the next step of the PHY state machine is due.
+
+/* Non-Sony: PHY state machine states */
+#define SMAP_PHY_STATE_IDLE		0	//Not running. The link is either up, or down until the next link check.
+#define SMAP_PHY_STATE_RESET		1
+#define SMAP_PHY_STATE_WAIT_LINK	2	//Waiting for a link without auto-negotiation.
+#define SMAP_PHY_STATE_WAIT_LINK_POLL	3
+#define SMAP_PHY_STATE_AUTONEGO		4	//Waiting for auto-negotiation to complete.
+#define SMAP_PHY_STATE_AUTONEGO_LINK	5
+#define SMAP_PHY_STATE_AUTONEGO_RETRY	6
+#define SMAP_PHY_STATE_FALLBACK_100M	7	//Auto-negotiation failed, trying 100Mbps half-duplex.
+#define SMAP_PHY_STATE_FALLBACK_10M	8	//Trying 10Mbps half-duplex.
+#define SMAP_PHY_STATE_CHECK		9	//Link is up, checking for receive errors.
+#define SMAP_PHY_STATE_CHECK_ERRORS	10
+#define SMAP_PHY_STATE_CONFIGURE	11
+#define SMAP_PHY_STATE_RELINK		12	//Link lost, waiting for it to return without resetting the PHY.
 
 /* Function prototypes */
 int DisplayBanner(void);
@@ -65,13 +187,15 @@ int smap_init(int argc, char *argv[]);
 int SMAPInitStart(void);
 int SMAPStart(void);
 void SMAPStop(void);
-void SMAPXmit(void);
+void SMAPXmit(int kick);
+int SMAPXmitDirect(struct pbuf *pbuf);
 int SMAPGetMACAddress(u8 *buffer);
 void PS2IPLinkStateUp(void);
 void PS2IPLinkStateDown(void);
 
-void SMapLowLevelInput(struct pbuf* pBuf);
-int SMapTxPacketNext(void **payload);
+int SMapLowLevelInput(struct pbuf* pBuf);
+int SMapTxPacketNext(struct pbuf **pbuf);
+void SMapTxQueueLimitUpdate(void);
 void SMapTxPacketDeQ(void);
 
 #include "xfer.h"
@@ -0,0 +1,212 @@
+/*	Public interface of the SMAP driver, exported as the "smap" library.	*/
+
+#ifndef _PS2SMAP_H
+#define _PS2SMAP_H
+
+#include <irx.h>
+
+/*	Early Rx filter.
+	Rules are evaluated in order, before a received frame is copied out of the Rx FIFO. The first rule that matches decides what happens to the frame.
+	Frames that match no rule are accepted.	*/
+#define SMAP_RX_FILTER_MAX	8
+
+/* Rule actions */
+#define SMAP_RX_FILTER_NONE	0	//Unused rule.
+#define SMAP_RX_FILTER_ACCEPT	1
+#define SMAP_RX_FILTER_DROP	2
+
+/* Fields that a rule matches on. A rule with no fields matches every frame. */
+#define SMAP_RX_FILTER_ETHERTYPE	0x01
+#define SMAP_RX_FILTER_DST_CLASS	0x02
+#define SMAP_RX_FILTER_IP_PROTO		0x04	//Implies IPv4.
+#define SMAP_RX_FILTER_IP_DST		0x08	//Implies IPv4.
+#define SMAP_RX_FILTER_DST_PORT		0x10	//Implies IPv4 TCP or UDP, and not a non-first fragment.
+#define SMAP_RX_FILTER_IP_FIELDS	(SMAP_RX_FILTER_IP_PROTO|SMAP_RX_FILTER_IP_DST|SMAP_RX_FILTER_DST_PORT)
+
+/* Destination MAC address classes */
+#define SMAP_RX_FILTER_UNICAST		0x01
+#define SMAP_RX_FILTER_MULTICAST	0x02
+#define SMAP_RX_FILTER_BROADCAST	0x04
+
+struct SmapRxFilterRule{
+	u8 action;	//SMAP_RX_FILTER_*
+	u8 fields;	//Fields to match on.
+	u8 DstClass;	//Bitmask of destination MAC address classes.
+	u8 IPProtocol;
+	u16 EtherType;
+	u16 DstPortMin;	//Destination port range (inclusive).
+	u16 DstPortMax;
+	u32 DstAddr;	//The destination IP address matches if (address & DstMask) == DstAddr. In host byte order.
+	u32 DstMask;
+};
+
+/*	Installs rule into slot index (replacing the previous rule and clearing its hit count), or clears the slot if rule is NULL.
+	Returns 0 on success, or a negative number if the index or rule is invalid.	*/
+int SMapRxFilterSet(unsigned int index, const struct SmapRxFilterRule *rule);
+//Returns the number of frames that matched the rule in slot index, or 0 if the index is invalid.
+u32 SMapRxFilterGetHits(unsigned int index);
+//Removes all rules.
+void SMapRxFilterClear(void);
+
+/*	Multicast filtering. The hardware filter is a hash, so frames for other groups may still be received.
+	Groups joined through IGMP are added automatically.	*/
+//Accepts multicast frames for the Ethernet address. Returns 0 on success, or a negative number if the address is not a multicast address.
+int SMapMulticastAdd(const u8 *address);
+//Stops accepting multicast frames for the Ethernet address, once it has been deleted as many times as it was added.
+int SMapMulticastDel(const u8 *address);
+//Accepts all multicast frames if enable is non-zero, regardless of the groups that were added.
+void SMapMulticastAll(int enable);
+
+/* Link loss and recovery. Times are in microseconds, taken from the system time. They wrap around every 71 minutes. */
+struct SmapLinkStats{
+	u32 LinkDownCount;	//Times that the link was lost.
+	u32 FastRelinkCount;	//Times that the link returned without resetting the PHY.
+	u32 FullRelinkCount;	//Times that the PHY had to be reset and auto-negotiation rerun.
+	u32 LastLinkDown;	//When the link was last lost.
+	u32 LastLinkUp;		//When the link last came back.
+	u32 LastTrafficResumed;	//When the first frame was received, after the link last came back.
+	u32 LastOutage;		//From LastLinkDown to LastTrafficResumed.
+	u32 MaxOutage;
+};
+
+//Copies the link loss and recovery statistics into stats.
+void SMapGetLinkStats(struct SmapLinkStats *stats);
+
+/*	Statistics snapshot. Fields are only ever added at the end, and version is raised when that happens.
+	A caller built against an older version passes the size of its own structure, and gets the fields that it knows of.	*/
+#define SMAP_STATS_VERSION		2
+#define SMAP_STATS_TX_CLASSES		3	//Tx priority classes: ARP, TCP ACKs and everything else.
+#define SMAP_STATS_SIZE_BUCKETS		6	//Frame sizes: <64, 64-127, 128-255, 256-511, 512-1023, 1024+ bytes.
+#define SMAP_STATS_LATENCY_BUCKETS	16	//Latency in microseconds: 0, 1, 2-3, 4-7, ..., 16384+.
+
+struct SmapStats{
+	u16 version;	//SMAP_STATS_VERSION of the driver.
+	u16 size;	//sizeof(struct SmapStats) of the driver.
+
+	//Traffic
+	u32 RxFrames;	//Frames handed over to the stack.
+	u32 RxBytes;
+	u32 TxFrames;	//Frames sent (or that failed to be sent).
+	u32 TxBytes;
+
+	//DEV9 bus: bytes moved through the FIFOs, including padding, and register/BD reads.
+	u32 RxDmaBytes;
+	u32 RxPioBytes;
+	u32 TxDmaBytes;
+	u32 TxPioBytes;
+	u32 RxBusReads;
+	u32 TxBusReads;
+
+	//Rx errors
+	u32 RxDropped;
+	u32 RxErrors;	//Sum of the error bits of all Rx BDs.
+	u32 RxOverrun;
+	u32 RxBadLength;
+	u32 RxBadFCS;
+	u32 RxBadAlignment;
+	u32 RxCsumOk;
+	u32 RxCsumBad;
+	u32 RxFilterDrop;
+	u32 RxPauseIntrs;	//EMAC3 interrupts that reported received pause frames, not the number of pause frames.
+	u32 RxPauseFrameDrop;
+
+	//Tx errors
+	u32 TxDropped;
+	u32 TxErrors;	//Sum of the error bits of all Tx BDs.
+	u32 TxLossCR;
+	u32 TxEDefer;
+	u32 TxCollision;
+	u32 TxUnderrun;
+
+	//Rx path
+	u32 RxAllocFail;
+	u32 RxRingEmpty;
+	u32 RxBatches;	//Times that frames were handed over to the stack.
+	u32 RxBatchFrames;
+	u32 RxBatchMax;
+	u32 RxPollMode;	//Times that Rx polling was entered.
+
+	//Tx path
+	u32 TxQueueHighWater;
+	u32 TxQueueFull;
+	u32 TxKicks;
+	u32 TxKicksSkipped;
+	u32 TxDirect;
+	u32 TxEndIntr;
+	u32 TxQueueBytes;	//Byte queue limit state, as of the last update.
+	u32 TxQueueLimit;
+	u32 TxQueueLimitHits;
+	u32 TxQueueStarved;
+	u32 TxClassFrames[SMAP_STATS_TX_CLASSES];
+	u32 TxClassDepth[SMAP_STATS_TX_CLASSES];
+
+	//EMAC3 settings, in bytes, and the number of times that -autotune changed them.
+	u32 TxThreshold;
+	u32 RxHiWater;
+	u32 TxThresholdChanges;
+	u32 RxHiWaterChanges;
+
+	//Histograms
+	u32 RxFrameSize[SMAP_STATS_SIZE_BUCKETS];
+	u32 TxFrameSize[SMAP_STATS_SIZE_BUCKETS];
+	u32 RxLatency[SMAP_STATS_LATENCY_BUCKETS];	//From the wakeup of the driver thread by an interrupt to the handover of the frames to the stack.
+
+	//Version 2
+	u32 RxCsumFragDrop;	//Fragments of TCP segments dropped by -rxcsum.
+};
+
+/*	Copies up to size bytes of the current statistics into stats. Returns the number of bytes copied.
+	All counters wrap around.	*/
+int SMapGetStats(struct SmapStats *stats, unsigned int size);
+
+/*	Trace ring of the hot paths. Records are only made if the driver was built with SMAP_TRACE=1.
+	Use smap/tools/smaptrace to print the latency of each stage from a dump.	*/
+#define SMAP_TRACE_MAGIC	0x52544D53	//"SMTR"
+#define SMAP_TRACE_VERSION	1
+
+/* Stages */
+#define SMAP_TRACE_INTR		0	//SMAP interrupt raised. arg: DEV9 interrupt number.
+#define SMAP_TRACE_WAKEUP	1	//Interrupt handler thread woke up. arg: event flag bits.
+#define SMAP_TRACE_RX_BD	2	//Rx BD read. arg: frame length.
+#define SMAP_TRACE_DMA_START	3	//arg: bytes to transfer, plus SMAP_TRACE_DMA_TX for the Tx FIFO.
+#define SMAP_TRACE_DMA_END	4	//arg: bytes transferred.
+#define SMAP_TRACE_RX_HANDOFF	5	//Received frames handed over to ps2ip. arg: number of frames.
+#define SMAP_TRACE_TX_ARM	6	//Tx BD marked ready. arg: frame length.
+#define SMAP_TRACE_TX_DONE	7	//Tx BD reclaimed. arg: Tx FIFO space freed.
+#define SMAP_TRACE_STAGES	8
+
+#define SMAP_TRACE_DMA_TX	0x8000
+
+struct SmapTraceRecord{
+	u32 time;	//Timer count.
+	u8 stage;	//SMAP_TRACE_*
+	u8 reserved;
+	u16 arg;
+};
+
+struct SmapTraceHeader{
+	u32 magic;	//SMAP_TRACE_MAGIC
+	u16 version;	//SMAP_TRACE_VERSION
+	u16 count;	//Number of records that follow.
+	u32 clock;	//Timer frequency, in Hz.
+	u32 lost;	//Number of older records that were no longer available.
+};
+
+/*	Copies the most recent trace records into buffer, after a struct SmapTraceHeader. Records are in chronological order.
+	Returns the number of records copied, or a negative number if tracing was not compiled in or the buffer is too small.	*/
+int SMapTraceDump(void *buffer, unsigned int size);
+
+#define smap_IMPORTS_start DECLARE_IMPORT_TABLE(smap, 1, 1)
+#define smap_IMPORTS_end END_IMPORT_TABLE
+
+#define I_SMapRxFilterSet DECLARE_IMPORT(4, SMapRxFilterSet)
+#define I_SMapRxFilterGetHits DECLARE_IMPORT(5, SMapRxFilterGetHits)
+#define I_SMapRxFilterClear DECLARE_IMPORT(6, SMapRxFilterClear)
+#define I_SMapMulticastAdd DECLARE_IMPORT(7, SMapMulticastAdd)
+#define I_SMapMulticastDel DECLARE_IMPORT(8, SMapMulticastDel)
+#define I_SMapMulticastAll DECLARE_IMPORT(9, SMapMulticastAll)
+#define I_SMapGetLinkStats DECLARE_IMPORT(10, SMapGetLinkStats)
+#define I_SMapTraceDump DECLARE_IMPORT(11, SMapTraceDump)
+#define I_SMapGetStats DECLARE_IMPORT(12, SMapGetStats)
+
+#endif
@@ -11,6 +11,9 @@
 #include <thbase.h>
 #include <thevent.h>
 #include <thsemap.h>
+#ifdef SMAP_TRACE
+#include <timrman.h>
+#endif
 #include <irx.h>
 
 #include <ps2ip.h>
@@ -61,7 +64,37 @@ static unsigned int ThreadStackSize=0x1000;
 static unsigned int EnableVerboseOutput=0;
 static unsigned int EnableAutoNegotiation=1;
 static unsigned int EnablePinStrapConfig=0;
-static unsigned int SmapConfiguration=0x5E0;
+static unsigned int EnableTxCoalescing=1;
+static unsigned int EnableTxDirect=0;
+static unsigned int SmapConfiguration=0xDE0;	/* Non-Sony: also advertise asymmetric pause (0x800). */
+static unsigned int RxPollBudget=0;
+static unsigned int RxPollThreshold=4;
+static unsigned int TxDmaPadMin=0;
+static unsigned int RxDmaPadMin=0;
+static unsigned int DmaSliceSize=64;
+static unsigned int DmaMin=64;
+static unsigned int EnableDmaCalibration=0;
+static unsigned int TxLatency=4;
+static unsigned int EnableRxChecksum=0;
+static unsigned int EnableAutoTune=0;
+static unsigned int RelinkWindow=2000;
+static unsigned int EnableWarmStart=0;
+//Tx interrupts that are enabled while frames are outstanding. -txend adds TXEND.
+static unsigned int TxIntrMask=SMAP_INTR_TXDNV;
+
+//Delay between two passes over the Rx FIFO while polling, in microseconds.
+#define SMAP_RX_POLL_INTERVAL	200
+
+/*	Tx threshold, in units of 64 bytes less one, and Rx watermarks, in units of 8 bytes.
+	With -autotune, the Tx threshold is raised on underruns and the Rx high watermark is lowered on overruns.
+	Each steps back towards its default after SMAP_AUTOTUNE_HOLD link-check ticks without errors. */
+#define SMAP_TX_THRESHOLD_DEFAULT	12	//832 bytes
+#define SMAP_TX_THRESHOLD_MAX		15	//1024 bytes, the size of the EMAC3 Tx FIFO.
+#define SMAP_RX_LO_WATER		16	//128 bytes
+#define SMAP_RX_HI_WATER_DEFAULT	128	//1024 bytes
+#define SMAP_RX_HI_WATER_MIN		32	//256 bytes
+#define SMAP_RX_HI_WATER_STEP		16
+#define SMAP_AUTOTUNE_HOLD		30
 
 extern void *_gp;
 
@@ -121,13 +154,36 @@ static u16 _smap_read_phy(volatile u8 *emac3_regbase, unsigned int address){
 static int DisplayHelpMessage(void){
 	DisplayBanner();
 
-	printf(	"Usage: smap [<option>] [thpri=<prio>] [thstack=<stack>] [<conf>]\n"
+	printf(	"Usage: smap [<option>] [thpri=<prio>] [thstack=<stack>] [rxbudget=<frames>] [rxpoll=<frames>]\n"
+		"            [txpad=<bytes>] [rxpad=<bytes>] [dmaslice=<bytes>] [dmamin=<bytes>]\n"
+		"            [txlatency=<ms>] [relink=<ms>] [<conf>]\n"
 		"  <option>:\n"
 		"    -verbose       display verbose messages\n"
 		"    -auto          auto nego enable            [default]\n"
 		"    -no_auto       fixed mode\n"
 		"    -strap         use pin-strap config\n"
-		"    -no_strap      do not use pin-strap config [default]\n");
+		"    -no_strap      do not use pin-strap config [default]\n"
+		"    -tx_coalesce   wake up the driver only on the first frame of a burst [default]\n"
+		"    -no_tx_coalesce wake up the driver for every frame\n"
+		"    -tx_direct     send from the caller's thread when the driver is idle\n"
+		"    -no_tx_direct  always send from the driver thread [default]\n"
+		"    -calibrate     measure the DMA block size and crossover at startup\n"
+		"    -txend         reclaim Tx FIFO space as soon as each frame is sent\n"
+		"    -no_txend      reclaim Tx FIFO space once the Tx BDs are drained [default]\n"
+		"    -rxcsum        verify IPv4 and TCP checksums while receiving (drops TCP fragments)\n"
+		"    -no_rxcsum     leave checksum verification to the stack [default]\n"
+		"    -autotune      adjust the Tx threshold and Rx watermark to the errors seen\n"
+		"    -no_autotune   use fixed Tx threshold and Rx watermark [default]\n"
+		"    -warm          adopt the link if the PHY is already linked at startup\n"
+		"    -no_warm       always reset the PHY at startup [default]\n"
+		"  rxbudget:        max. frames per Rx pass, 0 disables Rx polling [default: 0]\n"
+		"  rxpoll:          min. frames per pass to keep polling          [default: 4]\n"
+		"  txpad:           min. frame size to pad Tx DMA, 0 disables     [default: 0]\n"
+		"  rxpad:           min. frame size to pad Rx DMA, 0 disables     [default: 0]\n"
+		"  dmaslice:        DMA block size: 32, 64, 128 or 256            [default: 64]\n"
+		"  dmamin:          min. transfer size to use DMA for             [default: 64]\n"
+		"  txlatency:       Tx queue latency target, 0 disables the limit [default: 4]\n"
+		"  relink:          time to wait for a lost link to return as it was [default: 2000]\n");
 
 	return 2;
 }
@@ -137,153 +193,21 @@ static inline void RestartAutoNegotiation(volatile u8 *emac3_regbase, u16 bmsr){
 	_smap_write_phy(emac3_regbase, SMAP_DsPHYTER_BMCR, SMAP_PHY_BMCR_ANEN|SMAP_PHY_BMCR_RSAN);
 }
 
-static int InitPHY(struct SmapDriverData *SmapDrivPrivData){
+/*	Non-Sony: configures the PHY and EMAC3 for the mode that the link was established with.
+	Called once the link is up, from SMapPhyStep(). */
+static void SMapPhyConfigure(struct SmapDriverData *SmapDrivPrivData){
 	int i, result;
-	unsigned int LinkSpeed100M, LinkFDX, FlowControlEnabled, AutoNegoRetries;
+	unsigned int LinkSpeed100M, LinkFDX, FlowControlEnabled, TxPauseEnabled, RxPauseEnabled;
 	u32 emac3_value;
 	u16 RegDump[6], value, value2;
 	volatile u8 *emac3_regbase;
 
-	LinkSpeed100M=0;
-	if(EnableVerboseOutput!=0) DEBUG_PRINTF("smap: Resetting PHY\n");
-
-	_smap_write_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR, SMAP_PHY_BMCR_RST);
-	for(i=0; _smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR)&SMAP_PHY_BMCR_RST; i++){
-		if(i<=0){
-			DEBUG_PRINTF("smap: PHY reset error\n");
-			return -1;
-		}
-		if(SmapDrivPrivData->NetDevStopFlag) return 0;
-
-		DelayThread(1000);
-	}
-
-	if(!EnableAutoNegotiation){
-		if(EnableVerboseOutput!=0) DEBUG_PRINTF("smap: no auto mode (conf=0x%x)\n", SmapConfiguration);
-
-		LinkSpeed100M=0<(SmapConfiguration&0x180);	/* Toggles between SMAP_PHY_BMCR_10M and SMAP_PHY_BMCR_100M. */
-		value=LinkSpeed100M<<13;
-		if(SmapConfiguration&0x140) value|=SMAP_PHY_BMCR_DUPM;
-		_smap_write_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR, value);
-
-WaitLink:
-		DEBUG_PRINTF("smap: Waiting Valid Link for %dMbps\n", LinkSpeed100M?100:10);
-
-		i=0;
-		while(1){
-			DelayThread(200000);
-			if(SmapDrivPrivData->NetDevStopFlag) return 0;
-			i++;
-			if(_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMSR)&SMAP_PHY_BMSR_LINK) break;
-			if(i>=5) SmapDrivPrivData->LinkStatus=0;
-		}
-
-		SmapDrivPrivData->LinkStatus=1;
-	}
-	else{
-		if(!EnablePinStrapConfig){
-			_smap_write_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR, 0);
-			value=_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMSR);
-			if(!(value&0x4000)) SmapConfiguration=SmapConfiguration&0xFFFFFEFF;	/* 100Base-TX FDX */
-			if(!(value&0x2000)) SmapConfiguration=SmapConfiguration&0xFFFFFF7F;	/* 100Base-TX HDX */
-			if(!(value&0x1000)) SmapConfiguration=SmapConfiguration&0xFFFFFFBF;	/* 10Base-TX FDX */
-			if(!(value&0x0800)) SmapConfiguration=SmapConfiguration&0xFFFFFFDF;	/* 10Base-TX HDX */
-
-			DEBUG_PRINTF("smap: no strap mode (conf=0x%x, bmsr=0x%x)\n", SmapConfiguration, value);
-
-			value=_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_ANAR);
-			value=(SmapConfiguration&0x5E0)|(value&0x1F);
-			DEBUG_PRINTF("smap: anar=0x%x\n", value);
-			_smap_write_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_ANAR, value);
-			_smap_write_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR, SMAP_PHY_BMCR_ANEN|SMAP_PHY_BMCR_RSAN);
-		}
-		else{
-			if(!(_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR)&SMAP_PHY_BMCR_ANEN)){
-				goto WaitLink;
-			}
-		}
-
-		DEBUG_PRINTF("smap: auto mode (BMCR=0x%x ANAR=0x%x)\n", _smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR), _smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_ANAR));
-
-RepeatAutoNegoProcess:
-		for(AutoNegoRetries=0; AutoNegoRetries<3; AutoNegoRetries++){
-			for(i=0; i<3; i++){
-				DelayThread(1000000);
-				if(SmapDrivPrivData->NetDevStopFlag) return 0;
-			}
-
-			value=_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMSR);
-			if((value&(SMAP_PHY_BMSR_ANCP|0x10))==SMAP_PHY_BMSR_ANCP){	/* 0x30: SMAP_PHY_BMSR_ANCP and Remote fault. */
-				/* This seems to be checking for the link-up status. */
-				for(i=0; !(_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMSR)&SMAP_PHY_BMSR_LINK); i++){
-					DelayThread(200000);
-					if(SmapDrivPrivData->NetDevStopFlag) return 0;
-					if(i>=20) break;
-				}
-
-				if(i<20){
-					/* Auto negotiaton completed successfully. */
-					SmapDrivPrivData->LinkStatus=1;
-					break;
-				}
-				else RestartAutoNegotiation(SmapDrivPrivData->emac3_regbase, value);
-			}
-			else RestartAutoNegotiation(SmapDrivPrivData->emac3_regbase, value);
-		}
-
-		/* If automatic negotiation fails, manually figure out which speed and duplex mode to use. */
-		if(AutoNegoRetries>=3){
-			if(EnableVerboseOutput) DEBUG_PRINTF("smap: waiting valid link for 100Mbps Half-Duplex\n");
-
-			_smap_write_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR, SMAP_PHY_BMCR_100M);
-			DelayThread(1000000);
-			if(SmapDrivPrivData->NetDevStopFlag) return 0;
-
-			for(i=0; !(_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMSR)&SMAP_PHY_BMSR_LINK); i++){
-				DelayThread(100000);
-				if(SmapDrivPrivData->NetDevStopFlag) return 0;
-				if(i>=30) break;
-			}
-
-			if(i>=30){
-				if(EnableVerboseOutput) DEBUG_PRINTF("smap: waiting valid link for 10Mbps Half-Duplex\n");
-
-				_smap_write_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR, SMAP_PHY_BMCR_10M);
-				DelayThread(1000000);
-				if(SmapDrivPrivData->NetDevStopFlag) return 0;
-
-				for(i=0; !(_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMSR)&SMAP_PHY_BMSR_LINK); i++){
-					DelayThread(100000);
-					if(SmapDrivPrivData->NetDevStopFlag) return 0;
-					if(i>=30) break;
-				}
-
-				if(i>=0x1E) goto RepeatAutoNegoProcess;
-				else SmapDrivPrivData->LinkStatus=1;
-			}
-			else SmapDrivPrivData->LinkStatus=1;
-		}
-	}
-
 	for(i=0; i<6; i++) RegDump[i]=_smap_read_phy(SmapDrivPrivData->emac3_regbase, i);
 
 	if(EnableVerboseOutput) DEBUG_PRINTF("smap: PHY: %04x %04x %04x %04x %04x %04x\n", RegDump[SMAP_DsPHYTER_BMCR], RegDump[SMAP_DsPHYTER_BMSR], RegDump[SMAP_DsPHYTER_PHYIDR1], RegDump[SMAP_DsPHYTER_PHYIDR2], RegDump[SMAP_DsPHYTER_ANAR], RegDump[SMAP_DsPHYTER_ANLPAR]);
 
 	/* Special initialization for the National Semiconductor DP83846A PHY. */
 	if(RegDump[SMAP_DsPHYTER_PHYIDR1]==SMAP_PHY_IDR1_VAL && (RegDump[SMAP_DsPHYTER_PHYIDR2]&SMAP_PHY_IDR2_MSK)==SMAP_PHY_IDR2_VAL){
-		if(EnableAutoNegotiation){
-			_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_FCSCR);
-			_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_RECR);
-			DelayThread(500000);
-			value=_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_FCSCR);
-			value2=_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_RECR);
-			if((value2!=0) || (value>=0x11)){
-				if(EnableVerboseOutput) DEBUG_PRINTF("smap: FCSCR=%d RECR=%d\n", value, value2);
-				_smap_write_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR, 0);
-				goto WaitLink;
-			}
-		}
-
 		DEBUG_PRINTF("smap: PHY chip: DP83846A%d\n", (RegDump[SMAP_DsPHYTER_PHYIDR2]&SMAP_PHY_IDR2_REV_MSK)+1);
 
 		/* If operating in 10Mbit mode, disable the 10Mb/s Loopback mode. */
@@ -307,18 +231,27 @@ RepeatAutoNegoProcess:
 	}
 
 	/* Determine what was negotiated for. */
-	FlowControlEnabled=0;
+	TxPauseEnabled=RxPauseEnabled=0;
 	if(RegDump[SMAP_DsPHYTER_BMCR]&SMAP_PHY_BMCR_ANEN){
 		value=RegDump[SMAP_DsPHYTER_ANAR]&RegDump[SMAP_DsPHYTER_ANLPAR];
 		LinkSpeed100M=0<(value&0x180);
 		LinkFDX=0<(value&0x140);
-		if(LinkFDX) FlowControlEnabled=0<(value&0x400);
+		/*	Non-Sony: resolve pause as per IEEE 802.3 Annex 28B, using the PAUSE (0x400) and ASM_DIR (0x800) bits of both ends.
+			Tx pause means that the EMAC3 sends pause frames when its Rx FIFO fills up, Rx pause means that it obeys pause frames from the link partner. */
+		if(LinkFDX){
+			value=RegDump[SMAP_DsPHYTER_ANAR]&0xC00;
+			value2=RegDump[SMAP_DsPHYTER_ANLPAR]&0xC00;
+			if((value&0x400) && (value2&0x400)) TxPauseEnabled=RxPauseEnabled=1;
+			else if(value==0xC00 && value2==0x800) RxPauseEnabled=1;
+			else if(value==0x800 && value2==0xC00) TxPauseEnabled=1;
+		}
 	}
 	else{
 		LinkSpeed100M=RegDump[SMAP_DsPHYTER_BMCR]>>13&1;
 		LinkFDX=RegDump[SMAP_DsPHYTER_BMCR]>>8&1;
-		FlowControlEnabled=SmapConfiguration>>10&1;
+		TxPauseEnabled=RxPauseEnabled=SmapConfiguration>>10&1;
 	}
+	FlowControlEnabled=TxPauseEnabled|RxPauseEnabled;
 
 	if(LinkSpeed100M) result=LinkFDX?8:4;
 	else result=LinkFDX?2:1;
@@ -326,15 +259,252 @@ RepeatAutoNegoProcess:
 	SmapDrivPrivData->LinkMode=result;
 	if(FlowControlEnabled) SmapDrivPrivData->LinkMode|=0x40;
 
-	DEBUG_PRINTF("smap: %s %s Duplex Mode %s Flow Control\n", LinkSpeed100M?"100BaseTX":"10BaseT", LinkFDX?"Full":"Half", FlowControlEnabled?"with":"without");
+	DEBUG_PRINTF("smap: %s %s Duplex Mode %s Flow Control\n", LinkSpeed100M?"100BaseTX":"10BaseT", LinkFDX?"Full":"Half", FlowControlEnabled?(TxPauseEnabled?(RxPauseEnabled?"with":"with Tx"):"with Rx"):"without");
 
 	emac3_regbase=SmapDrivPrivData->emac3_regbase;
 	emac3_value=SMAP_EMAC3_GET32(SMAP_R_EMAC3_MODE1)&0x67FFFFFF;
 	if(LinkFDX) emac3_value|=SMAP_E3_FDX_ENABLE;
-	if(FlowControlEnabled) emac3_value|=SMAP_E3_FLOWCTRL_ENABLE|SMAP_E3_ALLOW_PF;
+	if(TxPauseEnabled) emac3_value|=SMAP_E3_FLOWCTRL_ENABLE;
+	if(RxPauseEnabled) emac3_value|=SMAP_E3_ALLOW_PF;
 	SMAP_EMAC3_SET32(SMAP_R_EMAC3_MODE1, emac3_value);
+}
 
-	return 0;
+//Returns the configuration, without the modes that the PHY does not support according to its BMSR.
+static unsigned int SMapPhyAbilities(u16 bmsr){
+	unsigned int configuration;
+
+	configuration=SmapConfiguration;
+	if(!(bmsr&0x4000)) configuration&=0xFFFFFEFF;	/* 100Base-TX FDX */
+	if(!(bmsr&0x2000)) configuration&=0xFFFFFF7F;	/* 100Base-TX HDX */
+	if(!(bmsr&0x1000)) configuration&=0xFFFFFFBF;	/* 10Base-TX FDX */
+	if(!(bmsr&0x0800)) configuration&=0xFFFFFFDF;	/* 10Base-TX HDX */
+
+	return configuration;
+}
+
+/*	Non-Sony: for -warm. Returns non-zero if the PHY already has a link, which was established in the way that it would be established now.
+	This is the case after the module is reloaded, or after the interface is stopped and started again. */
+static int SMapPhyIsLinked(struct SmapDriverData *SmapDrivPrivData){
+	u16 bmcr, bmsr, value;
+
+	//The link status bit latches low, so the first read may report a link loss that has already recovered.
+	_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMSR);
+	bmsr=_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMSR);
+	if(!(bmsr&SMAP_PHY_BMSR_LINK)) return 0;
+
+	bmcr=_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR);
+	if(!EnableAutoNegotiation){
+		value=(0<(SmapConfiguration&0x180))<<13;
+		if(SmapConfiguration&0x140) value|=SMAP_PHY_BMCR_DUPM;
+		return((bmcr&(SMAP_PHY_BMCR_ANEN|SMAP_PHY_BMCR_100M|SMAP_PHY_BMCR_DUPM))==value);
+	}
+
+	if(!(bmcr&SMAP_PHY_BMCR_ANEN) || (bmsr&(SMAP_PHY_BMSR_ANCP|0x10))!=SMAP_PHY_BMSR_ANCP) return 0;
+	if(!EnablePinStrapConfig){
+		//The advertised modes must be those that would be advertised now.
+		value=_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_ANAR);
+		if((value&0xDE0)!=(SMapPhyAbilities(bmsr)&0xDE0)) return 0;
+	}
+
+	return(_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_ANLPAR)!=0);
+}
+
+/*	Non-Sony: the PHY is brought up by a state machine, so that the interrupt handler thread can keep servicing Rx and Tx while waiting for the link.
+	Each call performs the next step, and returns the delay in microseconds until the following one, 0 once the link is up, or a negative number on error.
+	The steps and delays follow the original InitPHY(), which waited with DelayThread() instead. */
+static int SMapPhyStep(struct SmapDriverData *SmapDrivPrivData){
+	u16 value, value2;
+
+	while(1){
+		switch(SmapDrivPrivData->PhyState){
+			case SMAP_PHY_STATE_RESET:
+				if(EnableWarmStart && !SmapDrivPrivData->SmapIsInitialized && SMapPhyIsLinked(SmapDrivPrivData)){
+					DEBUG_PRINTF("smap: PHY is already linked, adopting its mode\n");
+					SmapDrivPrivData->PhyState=SMAP_PHY_STATE_CONFIGURE;
+					continue;
+				}
+
+				if(EnableVerboseOutput!=0) DEBUG_PRINTF("smap: Resetting PHY\n");
+
+				_smap_write_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR, SMAP_PHY_BMCR_RST);
+				if(_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR)&SMAP_PHY_BMCR_RST){
+					DEBUG_PRINTF("smap: PHY reset error\n");
+					SmapDrivPrivData->PhyState=SMAP_PHY_STATE_IDLE;
+					return -1;
+				}
+
+				if(!EnableAutoNegotiation){
+					if(EnableVerboseOutput!=0) DEBUG_PRINTF("smap: no auto mode (conf=0x%x)\n", SmapConfiguration);
+
+					value=(0<(SmapConfiguration&0x180))<<13;	/* Toggles between SMAP_PHY_BMCR_10M and SMAP_PHY_BMCR_100M. */
+					if(SmapConfiguration&0x140) value|=SMAP_PHY_BMCR_DUPM;
+					_smap_write_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR, value);
+					SmapDrivPrivData->PhyState=SMAP_PHY_STATE_WAIT_LINK;
+					continue;
+				}
+
+				if(!EnablePinStrapConfig){
+					_smap_write_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR, 0);
+					value=_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMSR);
+					SmapConfiguration=SMapPhyAbilities(value);
+
+					DEBUG_PRINTF("smap: no strap mode (conf=0x%x, bmsr=0x%x)\n", SmapConfiguration, value);
+
+					value=_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_ANAR);
+					value=(SmapConfiguration&0xDE0)|(value&0x1F);
+					DEBUG_PRINTF("smap: anar=0x%x\n", value);
+					_smap_write_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_ANAR, value);
+					_smap_write_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR, SMAP_PHY_BMCR_ANEN|SMAP_PHY_BMCR_RSAN);
+				}
+				else{
+					if(!(_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR)&SMAP_PHY_BMCR_ANEN)){
+						SmapDrivPrivData->PhyState=SMAP_PHY_STATE_WAIT_LINK;
+						continue;
+					}
+				}
+
+				DEBUG_PRINTF("smap: auto mode (BMCR=0x%x ANAR=0x%x)\n", _smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR), _smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_ANAR));
+
+				SmapDrivPrivData->PhyRetries=0;
+				SmapDrivPrivData->PhyState=SMAP_PHY_STATE_AUTONEGO;
+				return 3000000;
+			case SMAP_PHY_STATE_WAIT_LINK:
+				DEBUG_PRINTF("smap: Waiting Valid Link for %dMbps\n", (_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR)&SMAP_PHY_BMCR_100M)?100:10);
+				SmapDrivPrivData->PhyState=SMAP_PHY_STATE_WAIT_LINK_POLL;
+				return 200000;
+			case SMAP_PHY_STATE_WAIT_LINK_POLL:
+				if(!(_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMSR)&SMAP_PHY_BMSR_LINK))
+					return 200000;
+
+				SmapDrivPrivData->PhyState=SMAP_PHY_STATE_CHECK;
+				continue;
+			case SMAP_PHY_STATE_AUTONEGO:
+				value=_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMSR);
+				if((value&(SMAP_PHY_BMSR_ANCP|0x10))==SMAP_PHY_BMSR_ANCP){	/* 0x30: SMAP_PHY_BMSR_ANCP and Remote fault. */
+					SmapDrivPrivData->PhyPolls=0;
+					SmapDrivPrivData->PhyState=SMAP_PHY_STATE_AUTONEGO_LINK;
+					continue;
+				}
+
+				RestartAutoNegotiation(SmapDrivPrivData->emac3_regbase, value);
+				SmapDrivPrivData->PhyState=SMAP_PHY_STATE_AUTONEGO_RETRY;
+				continue;
+			case SMAP_PHY_STATE_AUTONEGO_LINK:
+				/* This seems to be checking for the link-up status. */
+				value=_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMSR);
+				if(value&SMAP_PHY_BMSR_LINK){
+					/* Auto negotiaton completed successfully. */
+					SmapDrivPrivData->PhyState=SMAP_PHY_STATE_CHECK;
+					continue;
+				}
+
+				if(SmapDrivPrivData->PhyPolls++<20)
+					return 200000;
+
+				RestartAutoNegotiation(SmapDrivPrivData->emac3_regbase, value);
+				SmapDrivPrivData->PhyState=SMAP_PHY_STATE_AUTONEGO_RETRY;
+				continue;
+			case SMAP_PHY_STATE_AUTONEGO_RETRY:
+				if(++SmapDrivPrivData->PhyRetries<3){
+					SmapDrivPrivData->PhyState=SMAP_PHY_STATE_AUTONEGO;
+					return 3000000;
+				}
+
+				/* If automatic negotiation fails, manually figure out which speed and duplex mode to use. */
+				if(EnableVerboseOutput) DEBUG_PRINTF("smap: waiting valid link for 100Mbps Half-Duplex\n");
+
+				_smap_write_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR, SMAP_PHY_BMCR_100M);
+				SmapDrivPrivData->PhyPolls=0;
+				SmapDrivPrivData->PhyState=SMAP_PHY_STATE_FALLBACK_100M;
+				return 1000000;
+			case SMAP_PHY_STATE_FALLBACK_100M:
+			case SMAP_PHY_STATE_FALLBACK_10M:
+				if(_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMSR)&SMAP_PHY_BMSR_LINK){
+					SmapDrivPrivData->PhyState=SMAP_PHY_STATE_CHECK;
+					continue;
+				}
+
+				if(SmapDrivPrivData->PhyPolls++<30)
+					return 100000;
+
+				if(SmapDrivPrivData->PhyState==SMAP_PHY_STATE_FALLBACK_100M){
+					if(EnableVerboseOutput) DEBUG_PRINTF("smap: waiting valid link for 10Mbps Half-Duplex\n");
+
+					_smap_write_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR, SMAP_PHY_BMCR_10M);
+					SmapDrivPrivData->PhyPolls=0;
+					SmapDrivPrivData->PhyState=SMAP_PHY_STATE_FALLBACK_10M;
+					return 1000000;
+				}
+
+				//Repeat the whole auto-negotiation process.
+				SmapDrivPrivData->PhyRetries=0;
+				SmapDrivPrivData->PhyState=SMAP_PHY_STATE_AUTONEGO;
+				return 3000000;
+			case SMAP_PHY_STATE_CHECK:
+				/* The National Semiconductor DP83846A PHY may establish a link with errors. If so, fall back to waiting for a link without auto-negotiation. */
+				if(EnableAutoNegotiation && _smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_PHYIDR1)==SMAP_PHY_IDR1_VAL && (_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_PHYIDR2)&SMAP_PHY_IDR2_MSK)==SMAP_PHY_IDR2_VAL){
+					_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_FCSCR);
+					_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_RECR);
+					SmapDrivPrivData->PhyState=SMAP_PHY_STATE_CHECK_ERRORS;
+					return 500000;
+				}
+
+				SmapDrivPrivData->PhyState=SMAP_PHY_STATE_CONFIGURE;
+				continue;
+			case SMAP_PHY_STATE_CHECK_ERRORS:
+				value=_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_FCSCR);
+				value2=_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_RECR);
+				if((value2!=0) || (value>=0x11)){
+					if(EnableVerboseOutput) DEBUG_PRINTF("smap: FCSCR=%d RECR=%d\n", value, value2);
+					_smap_write_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMCR, 0);
+					SmapDrivPrivData->PhyState=SMAP_PHY_STATE_WAIT_LINK;
+					continue;
+				}
+
+				SmapDrivPrivData->PhyState=SMAP_PHY_STATE_CONFIGURE;
+				continue;
+			case SMAP_PHY_STATE_RELINK:
+				/*	Non-Sony: the link was lost. Without resetting the PHY, give it the chance to come back with the same link partner,
+					as it would if the cable was only bumped. The PHY restarts auto-negotiation by itself if it was enabled.
+					The mode is resolved again once the link is up, in case that it has changed. */
+				if(_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMSR)&SMAP_PHY_BMSR_LINK){
+					SmapDrivPrivData->LinkStats.FastRelinkCount++;
+					SmapDrivPrivData->PhyState=SMAP_PHY_STATE_CONFIGURE;
+					continue;
+				}
+
+				if(SmapDrivPrivData->PhyPolls++<RelinkWindow/100)
+					return 100000;
+
+				if(EnableVerboseOutput) DEBUG_PRINTF("smap: link did not return, reinitializing the PHY\n");
+				SmapDrivPrivData->LinkStats.FullRelinkCount++;
+				SmapDrivPrivData->PhyState=SMAP_PHY_STATE_RESET;
+				continue;
+			case SMAP_PHY_STATE_CONFIGURE:
+				SMapPhyConfigure(SmapDrivPrivData);
+				SmapDrivPrivData->LinkStatus=1;
+				SmapDrivPrivData->PhyState=SMAP_PHY_STATE_IDLE;
+				return 0;
+			default:	//SMAP_PHY_STATE_IDLE
+				return 0;
+		}
+	}
+}
+
+//For the initial startup, where the caller has to wait until the link is up.
+static int InitPHY(struct SmapDriverData *SmapDrivPrivData){
+	int result;
+
+	SmapDrivPrivData->PhyState=SMAP_PHY_STATE_RESET;
+	while((result=SMapPhyStep(SmapDrivPrivData))>0){
+		DelayThread(result);
+		if(SmapDrivPrivData->NetDevStopFlag){
+			SmapDrivPrivData->PhyState=SMAP_PHY_STATE_IDLE;
+			return 0;
+		}
+	}
+
+	return result;
 }
 
 //This timer callback starts the Ethernet link check event.
@@ -351,6 +521,7 @@ static int HandleTxIntr(struct SmapDriverData *SmapDrivPrivData){
 	result=0;
 	while(SmapDrivPrivData->NumPacketsInTx>0){
 		ctrl_stat = tx_bd[SmapDrivPrivData->TxDNVBDIndex % SMAP_BD_MAX_ENTRY].ctrl_stat;
+		SmapDrivPrivData->RuntimeStats.TxBusReadCount++;
 		if(!(ctrl_stat & SMAP_BD_TX_READY)){
 			if(ctrl_stat&(SMAP_BD_TX_UNDERRUN|SMAP_BD_TX_LCOLL|SMAP_BD_TX_ECOLL|SMAP_BD_TX_EDEFER|SMAP_BD_TX_LOSSCR)){
 				for(i=0; i < 16; i++)
@@ -366,7 +537,9 @@ static int HandleTxIntr(struct SmapDriverData *SmapDrivPrivData){
 			break;
 
 		result++;
-		SmapDrivPrivData->TxBufferSpaceAvailable+=(tx_bd[SmapDrivPrivData->TxDNVBDIndex&(SMAP_BD_MAX_ENTRY-1)].length+3)&~3;
+		SMAP_TRACE_POINT(SMAP_TRACE_TX_DONE, SmapDrivPrivData->TxBDSize[SmapDrivPrivData->TxDNVBDIndex&(SMAP_BD_MAX_ENTRY-1)]);
+		SmapDrivPrivData->RuntimeStats.TxFrameCount++;
+		SmapDrivPrivData->TxBufferSpaceAvailable+=SmapDrivPrivData->TxBDSize[SmapDrivPrivData->TxDNVBDIndex&(SMAP_BD_MAX_ENTRY-1)];
 		SmapDrivPrivData->TxDNVBDIndex++;
 		SmapDrivPrivData->NumPacketsInTx--;
 	}
@@ -374,22 +547,194 @@ static int HandleTxIntr(struct SmapDriverData *SmapDrivPrivData){
 	return result;
 }
 
+/*	Non-Sony: the Tx FIFO, the Tx BDs and their accounting are shared between the interrupt handler thread and SMAPXmitDirect(), which runs in the tcpip-thread.
+	Whichever thread wants to use them must own TxLock. The IOP has no atomic instructions, so interrupts are suspended for the test-and-set.
+	If the lock could not be taken, the owner will issue an XMIT event upon releasing it, so that the interrupt handler thread will look at the Tx path again. */
+static int SMapTxTryLock(struct SmapDriverData *SmapDrivPrivData){
+	int OldState, result;
+
+	CpuSuspendIntr(&OldState);
+	if(!SmapDrivPrivData->TxLock){
+		SmapDrivPrivData->TxLock=1;
+		result=1;
+	}
+	else{
+		SmapDrivPrivData->TxLockContended=1;
+		result=0;
+	}
+	CpuResumeIntr(OldState);
+
+	return result;
+}
+
+static void SMapTxUnlock(struct SmapDriverData *SmapDrivPrivData){
+	int OldState, contended;
+
+	CpuSuspendIntr(&OldState);
+	contended=SmapDrivPrivData->TxLockContended;
+	SmapDrivPrivData->TxLockContended=0;
+	SmapDrivPrivData->TxLock=0;
+	CpuResumeIntr(OldState);
+
+	if(contended)
+		SetEventFlag(SmapDrivPrivData->Dev9IntrEventFlag, SMAP_EVENT_XMIT);
+}
+
+//Drops all frames in the Tx queue. Must only be called from the interrupt handler thread, which is the consumer of the queue.
+static void ClearPacketQueue(struct SmapDriverData *SmapDrivPrivData){
+	struct pbuf *pkt;
+
+	SmapDrivPrivData->packetToSend = NULL;
+	while(SMapTxPacketNext(&pkt) > 0)
+		SMapTxPacketDeQ();
+}
+
+//Returns the system time in microseconds. Wraps around every 71 minutes.
+static u32 SMapGetTimeUSec(void){
+	iop_sys_clock_t now;
+	u32 sec, usec;
+
+	GetSystemTime(&now);
+	SysClock2USec(&now, &sec, &usec);
+	return sec*1000000+usec;
+}
+
+//Enables the MAC once the link has been established for the first time, or reports that the link is back up.
+static void SMapLinkEstablished(struct SmapDriverData *SmapDrivPrivData){
+	volatile u8 *emac3_regbase;
+
+	if(!SmapDrivPrivData->SmapIsInitialized){
+		emac3_regbase=SmapDrivPrivData->emac3_regbase;
+		SMAP_EMAC3_SET32(SMAP_R_EMAC3_MODE0, SMAP_E3_TXMAC_ENABLE|SMAP_E3_RXMAC_ENABLE);
+		DelayThread(10000);
+		SmapDrivPrivData->SmapIsInitialized=1;
+
+		PS2IPLinkStateUp();
+
+		if(!SmapDrivPrivData->EnableLinkCheckTimer){
+			USec2SysClock(1000000, &SmapDrivPrivData->LinkCheckTimer);
+			SetAlarm(&SmapDrivPrivData->LinkCheckTimer, (void*)&LinkCheckTimerCB, SmapDrivPrivData);
+			SmapDrivPrivData->EnableLinkCheckTimer=1;
+		}
+	}
+	else{
+		SmapDrivPrivData->LinkStats.LastLinkUp=SMapGetTimeUSec();
+		SmapDrivPrivData->LinkRecovering=1;
+		PS2IPLinkStateUp();
+	}
+}
+
+//This one-shot timer callback advances the PHY state machine.
+static unsigned int PhyTimerCB(struct SmapDriverData *SmapDrivPrivData){
+	iSetEventFlag(SmapDrivPrivData->Dev9IntrEventFlag, SMAP_EVENT_PHY);
+	return 0;
+}
+
+/*	Non-Sony: performs the next step of the PHY state machine from the interrupt handler thread, and schedules the following one.
+	Returns a negative number on error. */
+static int SMapPhyRun(struct SmapDriverData *SmapDrivPrivData){
+	int result;
+
+	if((result=SMapPhyStep(SmapDrivPrivData))>0){
+		USec2SysClock(result, &SmapDrivPrivData->PhyTimer);
+		SetAlarm(&SmapDrivPrivData->PhyTimer, (void*)&PhyTimerCB, SmapDrivPrivData);
+	}
+	else if(result==0)
+		SMapLinkEstablished(SmapDrivPrivData);
+
+	return result;
+}
+
+static void SMapPhyCancel(struct SmapDriverData *SmapDrivPrivData){
+	if(SmapDrivPrivData->PhyState!=SMAP_PHY_STATE_IDLE){
+		CancelAlarm((void*)&PhyTimerCB, SmapDrivPrivData);
+		SmapDrivPrivData->PhyState=SMAP_PHY_STATE_IDLE;
+	}
+}
+
 //Checks the status of the Ethernet link
 static void CheckLinkStatus(struct SmapDriverData *SmapDrivPrivData){
+	//Non-Sony: the link is not checked while the PHY is being brought up.
+	if(SmapDrivPrivData->PhyState!=SMAP_PHY_STATE_IDLE)
+		return;
+
 	if(!(_smap_read_phy(SmapDrivPrivData->emac3_regbase, SMAP_DsPHYTER_BMSR)&SMAP_PHY_BMSR_LINK)){
 		//Link lost
 		SmapDrivPrivData->LinkStatus=0;
 		PS2IPLinkStateDown();
-		InitPHY(SmapDrivPrivData);
+		ClearPacketQueue(SmapDrivPrivData);
+
+		SmapDrivPrivData->LinkStats.LinkDownCount++;
+		SmapDrivPrivData->LinkStats.LastLinkDown=SMapGetTimeUSec();
+		SmapDrivPrivData->LinkRecovering=0;
+
+		/*	Non-Sony: bring up the PHY in the background, so that the Rx FIFO and Tx queue continue to be serviced.
+			The link is given the chance to return by itself first, before the PHY is reset.
+			If this fails, the link remains down and this is retried on the next link check. */
+		SmapDrivPrivData->PhyPolls=0;
+		SmapDrivPrivData->PhyState=SMAP_PHY_STATE_RELINK;
+		SMapPhyRun(SmapDrivPrivData);
+	}
+}
+
+static void SMapSetTxThreshold(struct SmapDriverData *SmapDrivPrivData, unsigned int threshold){
+	volatile u8 *emac3_regbase;
+
+	emac3_regbase=SmapDrivPrivData->emac3_regbase;
+	SMAP_EMAC3_SET32(SMAP_R_EMAC3_TX_THRESHOLD, (threshold&SMAP_E3_TX_THRESHLD_MSK) << SMAP_E3_TX_THRESHLD_BITSFT);
+	SmapDrivPrivData->TxThreshold=threshold;
+	SmapDrivPrivData->RuntimeStats.TxThreshold=(threshold+1)*64;
+}
 
-		//Link established
-		if(SmapDrivPrivData->LinkStatus)
-			PS2IPLinkStateUp();
+static void SMapSetRxWatermark(struct SmapDriverData *SmapDrivPrivData, unsigned int HiWater){
+	volatile u8 *emac3_regbase;
+
+	emac3_regbase=SmapDrivPrivData->emac3_regbase;
+	SMAP_EMAC3_SET32(SMAP_R_EMAC3_RX_WATERMARK, (SMAP_RX_LO_WATER&SMAP_E3_RX_LO_WATER_MSK) << SMAP_E3_RX_LO_WATER_BITSFT | (HiWater&SMAP_E3_RX_HI_WATER_MSK) << SMAP_E3_RX_HI_WATER_BITSFT);
+	SmapDrivPrivData->RxHiWater=HiWater;
+	SmapDrivPrivData->RuntimeStats.RxHiWater=HiWater*8;
+}
+
+/*	Non-Sony: adjusts the Tx threshold and Rx high watermark from the errors counted since the last link-check tick.
+	The Tx threshold is only changed while no frames are being sent. Until then, underruns are left to accumulate. */
+static void SMapAutoTune(struct SmapDriverData *SmapDrivPrivData){
+	u16 errors;
+
+	if(SmapDrivPrivData->NumPacketsInTx==0){
+		errors=SmapDrivPrivData->RuntimeStats.TxFrameUnderrunCount-SmapDrivPrivData->AutoTuneTxUnderruns;
+		SmapDrivPrivData->AutoTuneTxUnderruns=SmapDrivPrivData->RuntimeStats.TxFrameUnderrunCount;
+		if(errors>0){
+			SmapDrivPrivData->AutoTuneTxQuiet=0;
+			if(SmapDrivPrivData->TxThreshold<SMAP_TX_THRESHOLD_MAX){
+				SMapSetTxThreshold(SmapDrivPrivData, SmapDrivPrivData->TxThreshold+1);
+				SmapDrivPrivData->RuntimeStats.TxThresholdChangeCount++;
+			}
+		}
+		else if(SmapDrivPrivData->TxThreshold>SMAP_TX_THRESHOLD_DEFAULT && ++SmapDrivPrivData->AutoTuneTxQuiet>=SMAP_AUTOTUNE_HOLD){
+			SmapDrivPrivData->AutoTuneTxQuiet=0;
+			SMapSetTxThreshold(SmapDrivPrivData, SmapDrivPrivData->TxThreshold-1);
+			SmapDrivPrivData->RuntimeStats.TxThresholdChangeCount++;
+		}
+	}
+
+	errors=SmapDrivPrivData->RuntimeStats.RxFrameOverrunCount-SmapDrivPrivData->AutoTuneRxOverruns;
+	SmapDrivPrivData->AutoTuneRxOverruns=SmapDrivPrivData->RuntimeStats.RxFrameOverrunCount;
+	if(errors>0){
+		SmapDrivPrivData->AutoTuneRxQuiet=0;
+		if(SmapDrivPrivData->RxHiWater>SMAP_RX_HI_WATER_MIN){
+			SMapSetRxWatermark(SmapDrivPrivData, SmapDrivPrivData->RxHiWater-SMAP_RX_HI_WATER_STEP);
+			SmapDrivPrivData->RuntimeStats.RxHiWaterChangeCount++;
+		}
+	}
+	else if(SmapDrivPrivData->RxHiWater<SMAP_RX_HI_WATER_DEFAULT && ++SmapDrivPrivData->AutoTuneRxQuiet>=SMAP_AUTOTUNE_HOLD){
+		SmapDrivPrivData->AutoTuneRxQuiet=0;
+		SMapSetRxWatermark(SmapDrivPrivData, SmapDrivPrivData->RxHiWater+SMAP_RX_HI_WATER_STEP);
+		SmapDrivPrivData->RuntimeStats.RxHiWaterChangeCount++;
 	}
 }
 
 static void IntrHandlerThread(struct SmapDriverData *SmapDrivPrivData){
-	unsigned int ResetCounterFlag, IntrReg;
+	unsigned int ResetCounterFlag, IntrReg, IntrMask, TxLocked;
 	u32 EFBits;
 	int result, counter;
 	volatile u8 *smap_regbase, *emac3_regbase;
@@ -399,51 +744,68 @@ static void IntrHandlerThread(struct SmapDriverData *SmapDrivPrivData){
 	emac3_regbase=SmapDrivPrivData->emac3_regbase;
 	smap_regbase=SmapDrivPrivData->smap_regbase;
 	while(1){
-		if((result = WaitEventFlag(SmapDrivPrivData->Dev9IntrEventFlag, SMAP_EVENT_START|SMAP_EVENT_STOP|SMAP_EVENT_INTR|SMAP_EVENT_XMIT|SMAP_EVENT_LINK_CHECK, WEF_OR|WEF_CLEAR, &EFBits)) != 0)
+		if(SmapDrivPrivData->RxPolling){
+			/*	Non-Sony: while polling, RXEND is masked and the Rx FIFO is checked on every pass.
+				Give the other threads (including the tcpip-thread, which has to consume the frames) a chance to run and pick up any other events without blocking. */
+			DelayThread(SMAP_RX_POLL_INTERVAL);
+			if(PollEventFlag(SmapDrivPrivData->Dev9IntrEventFlag, SMAP_EVENT_START|SMAP_EVENT_STOP|SMAP_EVENT_INTR|SMAP_EVENT_XMIT|SMAP_EVENT_LINK_CHECK|SMAP_EVENT_PHY, WEF_OR|WEF_CLEAR, &EFBits) != 0)
+				EFBits = 0;
+		}
+		else if((result = WaitEventFlag(SmapDrivPrivData->Dev9IntrEventFlag, SMAP_EVENT_START|SMAP_EVENT_STOP|SMAP_EVENT_INTR|SMAP_EVENT_XMIT|SMAP_EVENT_LINK_CHECK|SMAP_EVENT_PHY, WEF_OR|WEF_CLEAR, &EFBits)) != 0)
 		{
 			DEBUG_PRINTF("smap: WaitEventFlag -> %d\n", result);
 			break;
 		}
 
+		SMAP_TRACE_POINT(SMAP_TRACE_WAKEUP, EFBits);
+
+		//Non-Sony: for the latency histogram of SMapGetStats(). Taken here rather than in the interrupt handler, to keep the latter short.
+		if(EFBits&SMAP_EVENT_INTR){
+			GetSystemTime(&SmapDrivPrivData->WakeupTime);
+			SmapDrivPrivData->WakeupTimeValid=1;
+		}
+
 		if(EFBits&SMAP_EVENT_STOP){
 			if(SmapDrivPrivData->SmapIsInitialized){
+				SMapPhyCancel(SmapDrivPrivData);
 				dev9IntrDisable(DEV9_SMAP_INTR_MASK2);
 				SMAP_EMAC3_SET32(SMAP_R_EMAC3_MODE0, 0);
 				SmapDrivPrivData->NetDevStopFlag=0;
 				SmapDrivPrivData->LinkStatus=0;
+				SmapDrivPrivData->RxPolling=0;
 				SmapDrivPrivData->SmapIsInitialized=0;
 				SmapDrivPrivData->SmapDriverStarted=0;
+				ClearPacketQueue(SmapDrivPrivData);
+				SMapRxRingFlush(SmapDrivPrivData);
 				PS2IPLinkStateDown();
 			}
+			else if(SmapDrivPrivData->SmapDriverStarted){
+				//Non-Sony: stopped while the PHY was being brought up from the START event.
+				SMapPhyCancel(SmapDrivPrivData);
+				dev9IntrDisable(DEV9_SMAP_INTR_MASK2);
+				SmapDrivPrivData->NetDevStopFlag=0;
+				SmapDrivPrivData->SmapDriverStarted=0;
+			}
 		}
 		if(EFBits&SMAP_EVENT_START){
-			if(!SmapDrivPrivData->SmapIsInitialized){
+			if(!SmapDrivPrivData->SmapIsInitialized && SmapDrivPrivData->PhyState==SMAP_PHY_STATE_IDLE){
 				SmapDrivPrivData->SmapDriverStarted=1;
 				dev9IntrEnable(DEV9_SMAP_INTR_MASK2);
-				if((result=InitPHY(SmapDrivPrivData))!=0) break;
-				if(SmapDrivPrivData->NetDevStopFlag){
-					SmapDrivPrivData->NetDevStopFlag=0;
-					continue;
-				}
-
-				SMAP_EMAC3_SET32(SMAP_R_EMAC3_MODE0, SMAP_E3_TXMAC_ENABLE|SMAP_E3_RXMAC_ENABLE);
-				DelayThread(10000);
-				SmapDrivPrivData->SmapIsInitialized=1;
-
-				PS2IPLinkStateUp();
-
-				if(!SmapDrivPrivData->EnableLinkCheckTimer){
-					USec2SysClock(1000000, &SmapDrivPrivData->LinkCheckTimer);
-					SetAlarm(&SmapDrivPrivData->LinkCheckTimer, (void*)&LinkCheckTimerCB, SmapDrivPrivData);
-					SmapDrivPrivData->EnableLinkCheckTimer=1;
-				}
+				//Non-Sony: the MAC is enabled once the PHY state machine has established the link.
+				SmapDrivPrivData->PhyState=SMAP_PHY_STATE_RESET;
+				if((result=SMapPhyRun(SmapDrivPrivData))<0) break;
+				EFBits&=~SMAP_EVENT_PHY;
 			}
 		}
+		if((EFBits&SMAP_EVENT_PHY) && SmapDrivPrivData->PhyState!=SMAP_PHY_STATE_IDLE){
+			//A failure during the initial startup is fatal, like it was for InitPHY().
+			if((result=SMapPhyRun(SmapDrivPrivData))<0 && !SmapDrivPrivData->SmapIsInitialized) break;
+		}
 
 		if(SmapDrivPrivData->SmapIsInitialized){
 			ResetCounterFlag=0;
 			if(EFBits&SMAP_EVENT_INTR){
-				if((IntrReg=SPD_REG16(SPD_R_INTR_STAT)&DEV9_SMAP_INTR_MASK)!=0){
+				if((IntrReg=SPD_REG16(SPD_R_INTR_STAT)&(DEV9_SMAP_INTR_MASK2|TxIntrMask))!=0){
 					/*	Original order/priority:
 							1. EMAC3
 							2. RXEND
@@ -451,11 +813,14 @@ static void IntrHandlerThread(struct SmapDriverData *SmapDrivPrivData){
 							4. TXDNV */
 					if(IntrReg&SMAP_INTR_EMAC3){
 						SMAP_REG16(SMAP_R_INTR_CLR)=SMAP_INTR_EMAC3;
-						SMAP_EMAC3_SET32(SMAP_R_EMAC3_INTR_STAT, SMAP_E3_INTR_TX_ERR_0|SMAP_E3_INTR_SQE_ERR_0|SMAP_E3_INTR_DEAD_0);
+						/*	Non-Sony: count the interrupts with pause frames received from the link partner.
+							The EMAC3 only latches that one was received, so this does not count the pause frames themselves. */
+						if(SMAP_EMAC3_GET32(SMAP_R_EMAC3_INTR_STAT)&SMAP_E3_INTR_PF) SmapDrivPrivData->RuntimeStats.RxPauseIntrCount++;
+						SMAP_EMAC3_SET32(SMAP_R_EMAC3_INTR_STAT, SMAP_E3_INTR_TX_ERR_0|SMAP_E3_INTR_SQE_ERR_0|SMAP_E3_INTR_DEAD_0|SMAP_E3_INTR_PF);
 					}
 					if(IntrReg&SMAP_INTR_RXEND){
 						SMAP_REG16(SMAP_R_INTR_CLR)=SMAP_INTR_RXEND;
-						ResetCounterFlag=HandleRxIntr(SmapDrivPrivData);
+						ResetCounterFlag=HandleRxIntr(SmapDrivPrivData, RxPollBudget);
 					}
 					if(IntrReg&SMAP_INTR_RXDNV){
 						SMAP_REG16(SMAP_R_INTR_CLR)=SMAP_INTR_RXDNV;
@@ -463,28 +828,88 @@ static void IntrHandlerThread(struct SmapDriverData *SmapDrivPrivData){
 					}
 					if(IntrReg&SMAP_INTR_TXDNV){
 						SMAP_REG16(SMAP_R_INTR_CLR)=SMAP_INTR_TXDNV;
-						HandleTxIntr(SmapDrivPrivData);
+						EFBits |= SMAP_EVENT_XMIT;
+					}
+					/*	Non-Sony: TXEND is raised whenever a frame has been sent, unlike TXDNV which is only raised once all Tx BDs have been sent.
+						Reclaiming the Tx FIFO space and refilling it right away keeps the FIFO from running dry during bulk transfers. */
+					if(IntrReg&SMAP_INTR_TXEND){
+						SMAP_REG16(SMAP_R_INTR_CLR)=SMAP_INTR_TXEND;
+						SmapDrivPrivData->RuntimeStats.TxEndIntrCount++;
 						EFBits |= SMAP_EVENT_XMIT;
 					}
 				}
 			}
 
-			if(EFBits&SMAP_EVENT_XMIT)
+			//Frames received from here on were not signalled by the last interrupt.
+			SmapDrivPrivData->WakeupTimeValid=0;
+
+			if(SmapDrivPrivData->RxPolling)
+				ResetCounterFlag+=HandleRxIntr(SmapDrivPrivData, RxPollBudget);
+
+			/*	Non-Sony: the Tx queue is always drained, not only when an XMIT event was received.
+				With Tx coalescing, the XMIT event is only issued when the queue becomes non-empty, so this ensures that a frame that was queued
+				while the link was down or the FIFO was full is not left behind.
+				If the tcpip-thread is currently sending a frame directly, it will issue an XMIT event once it is done. */
+			if((TxLocked=SMapTxTryLock(SmapDrivPrivData))!=0){
+				if(EFBits&SMAP_EVENT_XMIT)
+					HandleTxIntr(SmapDrivPrivData);
 				HandleTxReqs(SmapDrivPrivData);
-			//This was added in later versions.
-			HandleTxIntr(SmapDrivPrivData);
+				//This was added in later versions.
+				HandleTxIntr(SmapDrivPrivData);
+			}
+
+			/*	Non-Sony: switch to polling when a pass used up its whole budget, and back to interrupts once a pass yields fewer than RxPollThreshold frames.
+				RXEND is cleared before the final pass, so that a frame that arrives after it will raise an interrupt once RXEND is unmasked. */
+			if(RxPollBudget>0){
+				if(!SmapDrivPrivData->RxPolling){
+					if(ResetCounterFlag>=RxPollBudget){
+						SmapDrivPrivData->RxPolling=1;
+						SmapDrivPrivData->RuntimeStats.RxPollModeCount++;
+					}
+				}
+				else if(ResetCounterFlag<RxPollThreshold){
+					SmapDrivPrivData->RxPolling=0;
+					SMAP_REG16(SMAP_R_INTR_CLR)=SMAP_INTR_RXEND;
+					ResetCounterFlag+=HandleRxIntr(SmapDrivPrivData, 0);
+				}
+			}
 
 			//TXDNV is not enabled here, but only when frames are transmitted.
-			dev9IntrEnable(DEV9_SMAP_INTR_MASK2);
+			IntrMask=DEV9_SMAP_INTR_MASK2;
+			if(SmapDrivPrivData->RxPolling) IntrMask&=~SMAP_INTR_RXEND;
+			dev9IntrEnable(IntrMask);
+
+			if(TxLocked){
+				if(EnableAutoTune && (EFBits&SMAP_EVENT_LINK_CHECK))
+					SMapAutoTune(SmapDrivPrivData);
+
+				//If there are frames to send out, let Tx channel 0 know and enable TXDNV (and TXEND, if enabled).
+				if(SmapDrivPrivData->NumPacketsInTx>0){
+					SMAP_EMAC3_SET32(SMAP_R_EMAC3_TxMODE0, SMAP_E3_TX_GNP_0);
+					dev9IntrEnable(TxIntrMask);
+				}
 
-			//If there are frames to send out, let Tx channel 0 know and enable TXDNV.
-			if(SmapDrivPrivData->NumPacketsInTx>0){
-				SMAP_EMAC3_SET32(SMAP_R_EMAC3_TxMODE0, SMAP_E3_TX_GNP_0);
-				dev9IntrEnable(SMAP_INTR_TXDNV);
+				SMapTxUnlock(SmapDrivPrivData);
 			}
 
+			//Replace the Rx buffers that were consumed, now that the hardware has been serviced.
+			SMapRxRingRefill(SmapDrivPrivData);
+
+			//Non-Sony: the byte queue limit is updated on every tick, regardless of incoming traffic.
+			if(EFBits&SMAP_EVENT_LINK_CHECK)
+				SMapTxQueueLimitUpdate();
+
 			//Do the link check, only if there has not been any incoming traffic in a while.
 			if(ResetCounterFlag){
+				//Non-Sony: measure the time from the loss of the link to the first frame received after it came back.
+				if(SmapDrivPrivData->LinkRecovering){
+					SmapDrivPrivData->LinkRecovering=0;
+					SmapDrivPrivData->LinkStats.LastTrafficResumed=SMapGetTimeUSec();
+					SmapDrivPrivData->LinkStats.LastOutage=SmapDrivPrivData->LinkStats.LastTrafficResumed-SmapDrivPrivData->LinkStats.LastLinkDown;
+					if(SmapDrivPrivData->LinkStats.LastOutage>SmapDrivPrivData->LinkStats.MaxOutage)
+						SmapDrivPrivData->LinkStats.MaxOutage=SmapDrivPrivData->LinkStats.LastOutage;
+				}
+
 				counter=3;
 				continue;
 			}
@@ -502,6 +927,7 @@ static int Dev9IntrCb(int flag){
 	SaveGP();
 #endif
 
+	SMAP_TRACE_POINT(SMAP_TRACE_INTR, flag);
 	dev9IntrDisable(DEV9_SMAP_ALL_INTR_MASK);
 	iSetEventFlag(SmapDriverData.Dev9IntrEventFlag, SMAP_EVENT_INTR);
 
@@ -542,30 +968,14 @@ static void Dev9PostDmaCbHandler(int bcr, int dir){
 
 //For the initial startup, as legacy programs expect the Ethernet interface to be ready once SMAP finishes initialization.
 int SMAPInitStart(void){
-	int result;
-	volatile u8 *emac3_regbase;
-
 #if USE_GP_REGISTER
 	SaveGP();
 #endif
 
 	if(!SmapDriverData.SmapIsInitialized){
-		emac3_regbase=SmapDriverData.emac3_regbase;
-
 		dev9IntrEnable(DEV9_SMAP_INTR_MASK2);
-		if((result=InitPHY(&SmapDriverData))==0 && !SmapDriverData.NetDevStopFlag){
-			SMAP_EMAC3_SET32(SMAP_R_EMAC3_MODE0, SMAP_E3_TXMAC_ENABLE|SMAP_E3_RXMAC_ENABLE);
-			DelayThread(10000);
-			SmapDriverData.SmapIsInitialized=1;
-
-			PS2IPLinkStateUp();
-
-			if(!SmapDriverData.EnableLinkCheckTimer){
-				USec2SysClock(1000000, &SmapDriverData.LinkCheckTimer);
-				SetAlarm(&SmapDriverData.LinkCheckTimer, (void*)&LinkCheckTimerCB, &SmapDriverData);
-				SmapDriverData.EnableLinkCheckTimer=1;
-			}
-		}
+		if(InitPHY(&SmapDriverData)==0 && !SmapDriverData.NetDevStopFlag)
+			SMapLinkEstablished(&SmapDriverData);
 		else SmapDriverData.NetDevStopFlag=0;
 	}
 
@@ -599,31 +1009,62 @@ void SMAPStop(void){
 #endif
 }
 
-static void ClearPacketQueue(struct SmapDriverData *SmapDrivPrivData){
-	int OldState;
-	void *pkt;
+/*	Non-Sony: direct transmission from the tcpip-thread, used only if the Tx queue is empty (to preserve the order of frames).
+	This saves the switch to the interrupt handler thread, for request/response traffic.
+	Returns 0 if the frame was written into the Tx FIFO, or -1 if it has to be queued instead. */
+int SMAPXmitDirect(struct pbuf *pbuf){
+	volatile u8 *emac3_regbase;
+	int result;
 
-	CpuSuspendIntr(&OldState);
-	pkt = SmapDrivPrivData->packetToSend;
-	SmapDrivPrivData->packetToSend = NULL;
-	CpuResumeIntr(OldState);
+	if(!EnableTxDirect || !SmapDriverData.LinkStatus)
+		return -1;
 
-	if(pkt!=NULL){
-		while(SMapTxPacketNext(&pkt) > 0)
-			SMapTxPacketDeQ();
+#if USE_GP_REGISTER
+	SaveGP();
+#endif
+
+	result=-1;
+	if(SMapTxTryLock(&SmapDriverData)){
+		HandleTxIntr(&SmapDriverData);
+		if(SMapTransmitFrame(&SmapDriverData, pbuf, pbuf->tot_len)){
+			emac3_regbase=SmapDriverData.emac3_regbase;
+			SMAP_EMAC3_SET32(SMAP_R_EMAC3_TxMODE0, SMAP_E3_TX_GNP_0);
+			dev9IntrEnable(TxIntrMask);
+			SmapDriverData.RuntimeStats.TxDirectCount++;
+			result=0;
+		}
+
+		SMapTxUnlock(&SmapDriverData);
 	}
+
+#if USE_GP_REGISTER
+	RestoreGP();
+#endif
+
+	return result;
 }
 
-void SMAPXmit(void){
+/*	Non-Sony: if Tx coalescing is enabled, the XMIT event is only issued if kick is non-zero.
+	The caller sets kick when the frame was queued into an empty queue, or as a hint that a burst has ended.
+	The interrupt handler thread drains the whole queue in one pass, so any frame queued behind the first one will be picked up as well. */
+void SMAPXmit(int kick){
 #if USE_GP_REGISTER
 	SaveGP();
 #endif
 
+	if(EnableTxCoalescing && !kick){
+		SmapDriverData.RuntimeStats.TxKickSkippedCount++;
+#if USE_GP_REGISTER
+		RestoreGP();
+#endif
+		return;
+	}
+
+	/*	Non-Sony: if there is no link, the frame stays queued until either the link returns or the interrupt handler thread clears the queue.
+		The queue is no longer cleared here, as this runs in the context of the producer (the tcpip-thread). */
 	if(SmapDriverData.LinkStatus){
+		SmapDriverData.RuntimeStats.TxKickCount++;
 		SetEventFlag(SmapDriverData.Dev9IntrEventFlag, SMAP_EVENT_XMIT);
-	} else {
-		//No link. Clear the packet queue.
-		ClearPacketQueue(&SmapDriverData);
 	}
 
 #if USE_GP_REGISTER
@@ -666,6 +1107,17 @@ static inline int initialize(void){
 	return 0;
 }
 
+static int ParseNumericOption(const char *cmd, unsigned int *value){
+	const char *CmdString;
+
+	if(!isdigit(cmd[0])) return -1;
+
+	*value=strtoul(cmd, NULL, 10);
+	for(CmdString=cmd; isdigit(*CmdString); CmdString++){};
+
+	return(*CmdString=='\0'?0:-1);
+}
+
 static int ParseSmapConfiguration(const char *cmd, unsigned int *configuration){
 	const char *CmdStart, *DigitStart;
 	unsigned int result, base, character, value;
@@ -711,6 +1163,87 @@ fail_end:
 	return -1;
 }
 
+#ifdef SMAP_TRACE
+/*	Non-Sony: trace ring of the hot paths, compiled in with SMAP_TRACE=1.
+	Records are timestamped with a 32-bit hardware timer, which counts at the IOP clock (36.864MHz) and wraps around every 116 seconds.
+	The IOP has a single CPU, so the slot is taken and filled with interrupts suspended, which also allows records to be made from interrupt handlers.
+	SMapTraceDump() does not suspend interrupts while copying, but discards the records that were overwritten in the meantime. */
+#define SMAP_TRACE_SIZE		1024	//Must be a power of 2.
+#define SMAP_TRACE_CLOCK	36864000
+
+static struct SmapTraceRecord TraceRing[SMAP_TRACE_SIZE];
+static volatile u32 TraceHead;	//Number of records made so far.
+static int TraceTimerID=-1;
+
+static void SMapTraceInit(void){
+	if((TraceTimerID=AllocHardTimer(TC_SYSCLOCK, 32, 1))<0){
+		printf("smap: could not allocate a timer for tracing.\n");
+		return;
+	}
+
+	SetTimerMode(TraceTimerID, 0);
+	SetTimerCounter(TraceTimerID, 0);
+}
+
+void SMapTrace(unsigned int stage, unsigned int arg){
+	struct SmapTraceRecord *record;
+	int OldState;
+
+	if(TraceTimerID<0) return;
+
+	CpuSuspendIntr(&OldState);
+	record=&TraceRing[TraceHead%SMAP_TRACE_SIZE];
+	TraceHead++;
+	record->time=GetTimerCounter(TraceTimerID);
+	record->stage=stage;
+	record->arg=arg;
+	CpuResumeIntr(OldState);
+}
+
+int SMapTraceDump(void *buffer, unsigned int size){
+	struct SmapTraceHeader *header;
+	struct SmapTraceRecord *records;
+	unsigned int i, count, overwritten;
+	u32 start, end;
+
+	if(size<sizeof(struct SmapTraceHeader)) return -EINVAL;
+
+	header=buffer;
+	records=(struct SmapTraceRecord*)(header+1);
+
+	end=TraceHead;
+	count=(size-sizeof(struct SmapTraceHeader))/sizeof(struct SmapTraceRecord);
+	if(count>SMAP_TRACE_SIZE) count=SMAP_TRACE_SIZE;
+	if(count>end) count=end;
+	start=end-count;
+
+	for(i=0; i<count; i++)
+		records[i]=TraceRing[(start+i)%SMAP_TRACE_SIZE];
+
+	//Discard the oldest records, if they were overwritten while being copied.
+	overwritten=TraceHead-end;
+	if(overwritten>count) overwritten=count;
+	if(overwritten>0){
+		count-=overwritten;
+		start+=overwritten;
+		for(i=0; i<count; i++)
+			records[i]=records[i+overwritten];
+	}
+
+	header->magic=SMAP_TRACE_MAGIC;
+	header->version=SMAP_TRACE_VERSION;
+	header->count=count;
+	header->clock=SMAP_TRACE_CLOCK;
+	header->lost=start;
+
+	return count;
+}
+#else
+int SMapTraceDump(void *buffer, unsigned int size){
+	return -ENOSYS;
+}
+#endif
+
 int smap_init(int argc, char *argv[]){
 	int result, i;
 	const char *CmdString;
@@ -745,6 +1278,45 @@ int smap_init(int argc, char *argv[]){
 		else if(strcmp("-no_strap", *argv)==0){
 			EnablePinStrapConfig=0;
 		}
+		else if(strcmp("-tx_coalesce", *argv)==0){
+			EnableTxCoalescing=1;
+		}
+		else if(strcmp("-no_tx_coalesce", *argv)==0){
+			EnableTxCoalescing=0;
+		}
+		else if(strcmp("-tx_direct", *argv)==0){
+			EnableTxDirect=1;
+		}
+		else if(strcmp("-no_tx_direct", *argv)==0){
+			EnableTxDirect=0;
+		}
+		else if(strcmp("-calibrate", *argv)==0){
+			EnableDmaCalibration=1;
+		}
+		else if(strcmp("-txend", *argv)==0){
+			TxIntrMask=SMAP_INTR_TXDNV|SMAP_INTR_TXEND;
+		}
+		else if(strcmp("-no_txend", *argv)==0){
+			TxIntrMask=SMAP_INTR_TXDNV;
+		}
+		else if(strcmp("-rxcsum", *argv)==0){
+			EnableRxChecksum=1;
+		}
+		else if(strcmp("-no_rxcsum", *argv)==0){
+			EnableRxChecksum=0;
+		}
+		else if(strcmp("-autotune", *argv)==0){
+			EnableAutoTune=1;
+		}
+		else if(strcmp("-no_autotune", *argv)==0){
+			EnableAutoTune=0;
+		}
+		else if(strcmp("-warm", *argv)==0){
+			EnableWarmStart=1;
+		}
+		else if(strcmp("-no_warm", *argv)==0){
+			EnableWarmStart=0;
+		}
 		else if(strncmp("thpri=", *argv, 6)==0){
 			CmdString=&(*argv)[6];
 			if(isdigit(CmdString[0])){
@@ -776,6 +1348,31 @@ int smap_init(int argc, char *argv[]){
 			}
 			else return DisplayHelpMessage();
 		}
+		else if(strncmp("rxbudget=", *argv, 9)==0){
+			if(ParseNumericOption(&(*argv)[9], &RxPollBudget)!=0) return DisplayHelpMessage();
+		}
+		else if(strncmp("rxpoll=", *argv, 7)==0){
+			if(ParseNumericOption(&(*argv)[7], &RxPollThreshold)!=0) return DisplayHelpMessage();
+		}
+		else if(strncmp("txpad=", *argv, 6)==0){
+			if(ParseNumericOption(&(*argv)[6], &TxDmaPadMin)!=0) return DisplayHelpMessage();
+		}
+		else if(strncmp("rxpad=", *argv, 6)==0){
+			if(ParseNumericOption(&(*argv)[6], &RxDmaPadMin)!=0) return DisplayHelpMessage();
+		}
+		else if(strncmp("dmaslice=", *argv, 9)==0){
+			if(ParseNumericOption(&(*argv)[9], &DmaSliceSize)!=0) return DisplayHelpMessage();
+			if(DmaSliceSize<(1<<SMAP_DMA_SLICE_SHIFT_MIN) || DmaSliceSize>(1<<SMAP_DMA_SLICE_SHIFT_MAX) || (DmaSliceSize&(DmaSliceSize-1))!=0) return DisplayHelpMessage();
+		}
+		else if(strncmp("dmamin=", *argv, 7)==0){
+			if(ParseNumericOption(&(*argv)[7], &DmaMin)!=0) return DisplayHelpMessage();
+		}
+		else if(strncmp("txlatency=", *argv, 10)==0){
+			if(ParseNumericOption(&(*argv)[10], &TxLatency)!=0) return DisplayHelpMessage();
+		}
+		else if(strncmp("relink=", *argv, 7)==0){
+			if(ParseNumericOption(&(*argv)[7], &RelinkWindow)!=0) return DisplayHelpMessage();
+		}
 		else{
 			if(ParseSmapConfiguration(*argv, &SmapConfiguration)!=0) return DisplayHelpMessage();
 		}
@@ -829,6 +1426,12 @@ int smap_init(int argc, char *argv[]){
 	}
 
 	SmapDriverData.TxBufferSpaceAvailable=SMAP_TX_BUFSIZE;
+	SmapDriverData.TxDmaPadMin=TxDmaPadMin;
+	SmapDriverData.RxDmaPadMin=RxDmaPadMin;
+	SmapDriverData.DmaMin=DmaMin;
+	SmapDriverData.TxLatency=TxLatency;
+	SmapDriverData.EnableRxChecksum=EnableRxChecksum;
+	for(SmapDriverData.DmaSliceShift=SMAP_DMA_SLICE_SHIFT_MIN; (1<<SmapDriverData.DmaSliceShift)<DmaSliceSize; SmapDriverData.DmaSliceShift++){};
 
 	SMAP_REG16(SMAP_R_INTR_CLR)=DEV9_SMAP_ALL_INTR_MASK;
 
@@ -848,8 +1451,8 @@ int smap_init(int argc, char *argv[]){
 	//Tx FIFO request priority. Low: 7*8=56, urgent: 15*8=120.
 	SMAP_EMAC3_SET32(SMAP_R_EMAC3_TxMODE1, (7&SMAP_E3_TX_LOW_REQ_MSK) << SMAP_E3_TX_LOW_REQ_BITSFT | (15&SMAP_E3_TX_URG_REQ_MSK) << SMAP_E3_TX_URG_REQ_BITSFT);
 	SMAP_EMAC3_SET32(SMAP_R_EMAC3_RxMODE, SMAP_E3_RX_STRIP_PAD|SMAP_E3_RX_STRIP_FCS|SMAP_E3_RX_INDIVID_ADDR|SMAP_E3_RX_BCAST|SMAP_E3_RX_MCAST);
-	SMAP_EMAC3_SET32(SMAP_R_EMAC3_INTR_STAT, SMAP_E3_INTR_TX_ERR_0|SMAP_E3_INTR_SQE_ERR_0|SMAP_E3_INTR_DEAD_0);
-	SMAP_EMAC3_SET32(SMAP_R_EMAC3_INTR_ENABLE, SMAP_E3_INTR_TX_ERR_0|SMAP_E3_INTR_SQE_ERR_0|SMAP_E3_INTR_DEAD_0);
+	SMAP_EMAC3_SET32(SMAP_R_EMAC3_INTR_STAT, SMAP_E3_INTR_TX_ERR_0|SMAP_E3_INTR_SQE_ERR_0|SMAP_E3_INTR_DEAD_0|SMAP_E3_INTR_PF);
+	SMAP_EMAC3_SET32(SMAP_R_EMAC3_INTR_ENABLE, SMAP_E3_INTR_TX_ERR_0|SMAP_E3_INTR_SQE_ERR_0|SMAP_E3_INTR_DEAD_0|SMAP_E3_INTR_PF);
 
 	mac_address=(u16)(eeprom_data[0]>>8 | eeprom_data[0]<<8);
 	SMAP_EMAC3_SET32(SMAP_R_EMAC3_ADDR_HI, mac_address);
@@ -859,6 +1462,7 @@ int smap_init(int argc, char *argv[]){
 
 	SMAP_EMAC3_SET32(SMAP_R_EMAC3_PAUSE_TIMER, 0xFFFF);
 
+	//Non-Sony: no multicast groups are accepted until they are added with SMapMulticastAdd(), or through IGMP.
 	SMAP_EMAC3_SET32(SMAP_R_EMAC3_GROUP_HASH1, 0);
 	SMAP_EMAC3_SET32(SMAP_R_EMAC3_GROUP_HASH2, 0);
 	SMAP_EMAC3_SET32(SMAP_R_EMAC3_GROUP_HASH3, 0);
@@ -866,9 +1470,9 @@ int smap_init(int argc, char *argv[]){
 
 	SMAP_EMAC3_SET32(SMAP_R_EMAC3_INTER_FRAME_GAP, 4);
 	//Tx threshold, (12+1)*64=832.
-	SMAP_EMAC3_SET32(SMAP_R_EMAC3_TX_THRESHOLD, (12&SMAP_E3_TX_THRESHLD_MSK) << SMAP_E3_TX_THRESHLD_BITSFT);
+	SMapSetTxThreshold(&SmapDriverData, SMAP_TX_THRESHOLD_DEFAULT);
 	//Rx watermark, low: 16*8=128, high: 128*8=1024.
-	SMAP_EMAC3_SET32(SMAP_R_EMAC3_RX_WATERMARK, (16&SMAP_E3_RX_LO_WATER_MSK) << SMAP_E3_RX_LO_WATER_BITSFT | (128&SMAP_E3_RX_HI_WATER_MSK) << SMAP_E3_RX_HI_WATER_BITSFT);
+	SMapSetRxWatermark(&SmapDriverData, SMAP_RX_HI_WATER_DEFAULT);
 
 	//Register the interrupt handlers for all SMAP events.
 	for(i=2; i<7; i++) dev9RegisterIntrCb(i, &Dev9IntrCb);
@@ -876,6 +1480,19 @@ int smap_init(int argc, char *argv[]){
 	dev9RegisterPreDmaCb(1, &Dev9PreDmaCbHandler);
 	dev9RegisterPostDmaCb(1, &Dev9PostDmaCbHandler);
 
+	//Non-Sony: the Tx FIFO is not in use until the interface is started, so it can be used for calibrating DMA here.
+	if(EnableDmaCalibration){
+		if(SMapDmaCalibrate(&SmapDriverData, EnableVerboseOutput)!=0){
+			printf("smap: DMA calibration failed.\n");
+			return -2;
+		}
+	}
+	if(EnableVerboseOutput) DEBUG_PRINTF("smap: DMA block size: %u bytes, DMA used from %u bytes\n", 1<<SmapDriverData.DmaSliceShift, SmapDriverData.DmaMin);
+
+#ifdef SMAP_TRACE
+	SMapTraceInit();
+#endif
+
 	return initialize();
 }
 
@@ -902,3 +1519,182 @@ int SMAPGetMACAddress(u8 *buffer){
 
 	return 0;
 }
+
+/*	Non-Sony: multicast filtering. The EMAC3 accepts a multicast frame if the bit for its destination address is set in the 64-bit group hash.
+	The bit is selected by the upper 6 bits of the Ethernet CRC of the address, like in the other IBM EMAC drivers.
+	As several groups may share a bit, each bit has a reference count.	*/
+static u32 SMapEtherCrc(const u8 *address){
+	unsigned int i, j;
+	u32 crc;
+	u8 byte;
+
+	crc=0xFFFFFFFF;
+	for(i=0; i<6; i++){
+		byte=address[i];
+		for(j=0; j<8; j++,byte>>=1){
+			if(((crc>>31)^byte)&1)
+				crc=(crc<<1)^0x04C11DB7;
+			else
+				crc<<=1;
+		}
+	}
+
+	return crc;
+}
+
+static void SMapMulticastUpdate(const u8 *address, int add){
+	volatile u8 *emac3_regbase;
+	unsigned int slot, reg;
+	int OldState, changed;
+	u32 value;
+
+	emac3_regbase=SmapDriverData.emac3_regbase;
+	slot=63-(SMapEtherCrc(address)>>26);
+	reg=SMAP_R_EMAC3_GROUP_HASH1+(slot>>4)*(SMAP_R_EMAC3_GROUP_HASH2-SMAP_R_EMAC3_GROUP_HASH1);
+
+	CpuSuspendIntr(&OldState);
+
+	changed=0;
+	if(add){
+		changed=(SmapDriverData.McastHashRef[slot]++==0);
+	}
+	else if(SmapDriverData.McastHashRef[slot]>0){
+		changed=(--SmapDriverData.McastHashRef[slot]==0);
+	}
+
+	if(changed){
+		value=SMAP_EMAC3_GET32(reg);
+		if(add) value|=0x8000>>(slot&0xF);
+		else value&=~(0x8000>>(slot&0xF));
+		SMAP_EMAC3_SET32(reg, value);
+	}
+
+	CpuResumeIntr(OldState);
+}
+
+int SMapMulticastAdd(const u8 *address){
+	if(!(address[0]&1)) return -EINVAL;
+
+	SMapMulticastUpdate(address, 1);
+	return 0;
+}
+
+int SMapMulticastDel(const u8 *address){
+	if(!(address[0]&1)) return -EINVAL;
+
+	SMapMulticastUpdate(address, 0);
+	return 0;
+}
+
+int SMapGetStats(struct SmapStats *stats, unsigned int size){
+	struct SmapStats snapshot;
+	const struct RuntimeStats *rs;
+	unsigned int i;
+	int OldState;
+
+	rs=&SmapDriverData.RuntimeStats;
+
+	CpuSuspendIntr(&OldState);
+
+	snapshot.version=SMAP_STATS_VERSION;
+	snapshot.size=sizeof(struct SmapStats);
+
+	snapshot.RxFrames=rs->RxFrameCount;
+	snapshot.RxBytes=rs->RxByteCount;
+	snapshot.TxFrames=rs->TxFrameCount;
+	snapshot.TxBytes=rs->TxByteCount;
+
+	snapshot.RxDmaBytes=rs->RxDmaByteCount;
+	snapshot.RxPioBytes=rs->RxFifoByteCount-rs->RxDmaByteCount;
+	snapshot.TxDmaBytes=rs->TxDmaByteCount;
+	snapshot.TxPioBytes=rs->TxFifoByteCount-rs->TxDmaByteCount;
+	snapshot.RxBusReads=rs->RxBusReadCount;
+	snapshot.TxBusReads=rs->TxBusReadCount;
+
+	snapshot.RxDropped=rs->RxDroppedFrameCount;
+	snapshot.RxErrors=rs->RxErrorCount;
+	snapshot.RxOverrun=rs->RxFrameOverrunCount;
+	snapshot.RxBadLength=rs->RxFrameBadLengthCount;
+	snapshot.RxBadFCS=rs->RxFrameBadFCSCount;
+	snapshot.RxBadAlignment=rs->RxFrameBadAlignmentCount;
+	snapshot.RxCsumOk=rs->RxCsumOkCount;
+	snapshot.RxCsumBad=rs->RxCsumBadCount;
+	snapshot.RxFilterDrop=rs->RxFilterDropCount;
+	snapshot.RxPauseIntrs=rs->RxPauseIntrCount;
+	snapshot.RxPauseFrameDrop=rs->RxPauseFrameDropCount;
+
+	snapshot.TxDropped=rs->TxDroppedFrameCount;
+	snapshot.TxErrors=rs->TxErrorCount;
+	snapshot.TxLossCR=rs->TxFrameLOSSCRCount;
+	snapshot.TxEDefer=rs->TxFrameEDEFERCount;
+	snapshot.TxCollision=rs->TxFrameCollisionCount;
+	snapshot.TxUnderrun=rs->TxFrameUnderrunCount;
+
+	snapshot.RxAllocFail=rs->RxAllocFail;
+	snapshot.RxRingEmpty=rs->RxRingEmpty;
+	snapshot.RxBatches=rs->RxBatchCount;
+	snapshot.RxBatchFrames=rs->RxBatchFrameCount;
+	snapshot.RxBatchMax=rs->RxBatchMax;
+	snapshot.RxPollMode=rs->RxPollModeCount;
+
+	snapshot.TxQueueHighWater=rs->TxQueueHighWater;
+	snapshot.TxQueueFull=rs->TxQueueFullCount;
+	snapshot.TxKicks=rs->TxKickCount;
+	snapshot.TxKicksSkipped=rs->TxKickSkippedCount;
+	snapshot.TxDirect=rs->TxDirectCount;
+	snapshot.TxEndIntr=rs->TxEndIntrCount;
+	snapshot.TxQueueBytes=rs->TxQueueBytes;
+	snapshot.TxQueueLimit=rs->TxQueueLimit;
+	snapshot.TxQueueLimitHits=rs->TxQueueLimitCount;
+	snapshot.TxQueueStarved=rs->TxQueueStarvedCount;
+	for(i=0; i<SMAP_STATS_TX_CLASSES; i++){
+		snapshot.TxClassFrames[i]=rs->TxClassFrameCount[i];
+		snapshot.TxClassDepth[i]=rs->TxClassDepth[i];
+	}
+
+	snapshot.TxThreshold=rs->TxThreshold;
+	snapshot.RxHiWater=rs->RxHiWater;
+	snapshot.TxThresholdChanges=rs->TxThresholdChangeCount;
+	snapshot.RxHiWaterChanges=rs->RxHiWaterChangeCount;
+
+	for(i=0; i<SMAP_STATS_SIZE_BUCKETS; i++){
+		snapshot.RxFrameSize[i]=rs->RxFrameSizeHist[i];
+		snapshot.TxFrameSize[i]=rs->TxFrameSizeHist[i];
+	}
+	for(i=0; i<SMAP_STATS_LATENCY_BUCKETS; i++)
+		snapshot.RxLatency[i]=rs->RxLatencyHist[i];
+
+	snapshot.RxCsumFragDrop=rs->RxCsumFragDropCount;
+
+	CpuResumeIntr(OldState);
+
+	if(size>sizeof(struct SmapStats)) size=sizeof(struct SmapStats);
+	memcpy(stats, &snapshot, size);
+
+	return size;
+}
+
+void SMapGetLinkStats(struct SmapLinkStats *stats){
+	int OldState;
+
+	CpuSuspendIntr(&OldState);
+	memcpy(stats, &SmapDriverData.LinkStats, sizeof(struct SmapLinkStats));
+	CpuResumeIntr(OldState);
+}
+
+void SMapMulticastAll(int enable){
+	volatile u8 *emac3_regbase;
+	int OldState;
+	u32 value;
+
+	emac3_regbase=SmapDriverData.emac3_regbase;
+
+	CpuSuspendIntr(&OldState);
+
+	value=SMAP_EMAC3_GET32(SMAP_R_EMAC3_RxMODE);
+	if(enable) value|=SMAP_E3_RX_PROMISC_MCAST;
+	else value&=~SMAP_E3_RX_PROMISC_MCAST;
+	SMAP_EMAC3_SET32(SMAP_R_EMAC3_RxMODE, value);
+
+	CpuResumeIntr(OldState);
+}
@@ -0,0 +1,666 @@
+/*	Tests of the whole SMAP driver: main.c, smap.c and xfer.c are loaded like on the IOP, and run in the interrupt handler thread against
+	the models of the hardware and the kernel. The test itself stands in for the tcpip-thread. Each test starts with the driver unloaded.	*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <tamtypes.h>
+#include <thbase.h>
+#include <intrman.h>
+#include <irx.h>
+#include <ps2ip.h>
+#include <smapregs.h>
+
+#include "main.h"
+#include "xfer.h"
+
+#include "sim.h"
+#include "test.h"
+
+//From lwip/err.h
+#define ERR_OK		0
+#define ERR_MEM		-1
+#define ERR_CONN	-6
+
+//Abilities of the link partner, in the format of ANLPAR.
+#define PARTNER_ALL		0x05E1
+#define PARTNER_10M_FDX		0x0041
+
+extern struct SmapDriverData SmapDriverData;
+
+//_start() of main.c, renamed by the Makefile.
+int SMapModuleStart(int argc, char *argv[]);
+
+/* Helpers */
+
+//Loads the driver like the IOP would, with the addresses and the options given. Returns what the entry point of the module returned, once the link is up.
+static int Load(const char *options){
+	static char buffer[256];
+	char *argv[16], *option;
+	int argc, result;
+
+	argv[0] = "smap";
+	argv[1] = "192.168.0.10";
+	argv[2] = "255.255.255.0";
+	argv[3] = "192.168.0.1";
+	argc = 4;
+	strncpy(buffer, options, sizeof(buffer) - 1);
+	for(option = strtok(buffer, " "); option != NULL && argc < 15; option = strtok(NULL, " "))
+		argv[argc++] = option;
+	argv[argc] = NULL;
+
+	result = SMapModuleStart(argc, argv);
+	SimTcpipRun();
+
+	return result;
+}
+
+//Returns the time since the model was reset, in microseconds.
+static unsigned int Elapsed(void){
+	return SimTime - SIM_TIME_START;
+}
+
+static u32 Emac3(unsigned int offset){
+	return *(u32*)&SimEmac3Regs[offset];
+}
+
+enum FRAME_TYPE{
+	FRAME_ARP,
+	FRAME_ACK,	//TCP segment without data
+	FRAME_TCP,	//TCP segment with data
+	FRAME_UDP
+};
+
+/*	Builds a frame of length bytes (for the types that carry data) into frame. Returns its length.
+	The id is stored in the last two bytes of the source address, so that the frame can be told apart on the wire.	*/
+static unsigned int BuildFrame(u8 *frame, enum FRAME_TYPE type, u16 id, unsigned int length){
+	static const u8 peer[6] = {0x00, 0x11, 0x22, 0x33, 0x44, 0x55};
+	unsigned int i;
+
+	if(type == FRAME_ARP) length = 42;
+	else if(type == FRAME_ACK) length = 54;
+
+	for(i = 0; i < length; i++)
+		frame[i] = i;
+	memcpy(frame, peer, 6);
+	memcpy(&frame[6], SimMacAddress, 6);
+	frame[10] = id >> 8;
+	frame[11] = id;
+
+	if(type == FRAME_ARP){
+		frame[12] = 0x08;
+		frame[13] = 0x06;
+		return length;
+	}
+
+	frame[12] = 0x08;
+	frame[13] = 0x00;
+	frame[14] = 0x45;
+	frame[14 + 2] = (length - 14) >> 8;
+	frame[14 + 3] = length - 14;
+	frame[14 + 6] = 0x40;	//DF
+	frame[14 + 7] = 0;
+	frame[14 + 9] = (type == FRAME_UDP) ? 17 : 6;
+	if(type != FRAME_UDP){
+		frame[14 + 20 + 12] = 0x50;	//No options
+		frame[14 + 20 + 13] = 0x10;	//ACK
+	}
+
+	return length;
+}
+
+static u16 FrameId(const u8 *frame){
+	return frame[10] << 8 | frame[11];
+}
+
+//Passes a frame to the driver like the stack would, and lets go of it. Returns what the driver returned.
+static err_t Send(const u8 *frame, unsigned int length){
+	struct pbuf *p;
+	err_t result;
+
+	p = SimPbufRef(frame, length, 0);
+	result = SimNetif->linkoutput(SimNetif, p);
+	pbuf_free(p);
+
+	return result;
+}
+
+//Checks that the frames sent, up to count, carry the ids given.
+static void CheckTxOrder(const char *test, const u16 *ids, unsigned int count){
+	unsigned int i;
+
+	CHECK(SimTxFrameCount == count, "%s: %u frames sent, expected %u", test, SimTxFrameCount, count);
+	for(i = 0; i < count && i < SimTxFrameCount; i++)
+		CHECK(FrameId(SimTxFrames[i].data) == ids[i], "%s: frame %u on the wire is %u, expected %u", test, i, FrameId(SimTxFrames[i].data), ids[i]);
+}
+
+//Stops the driver, which lets go of the frames that it holds. The only pbufs left should then be the frames delivered to the stack.
+static void CheckNoLeaks(const char *test){
+	SMAPStop();
+	SimRun(1000);
+	CHECK(SimPbufsInUse == (int)SimRxDeliveredCount, "%s: %d pbufs leaked", test, SimPbufsInUse - (int)SimRxDeliveredCount);
+}
+
+/* PHY */
+
+void TestBoot(unsigned int arg){
+	u32 mode;
+
+	(void)arg;
+
+	SimReset();
+	CHECK(Load("") == MODULE_RESIDENT_END, "boot: not loaded");
+	//3s of auto-negotiation, 0.5s of checking for receive errors and 10ms after enabling the MAC.
+	CHECK(Elapsed() >= 3510000 && Elapsed() < 3600000, "boot: took %u ms", Elapsed() / 1000);
+	CHECK(SimPhyResets == 1, "boot: the PHY was reset %u times", SimPhyResets);
+	CHECK(SmapDriverData.LinkStatus && SmapDriverData.LinkMode == (8 | 0x40), "boot: link mode 0x%x", SmapDriverData.LinkMode);
+	CHECK(SimPhySpeed() == 100, "boot: the PHY runs at %u Mbit/s", SimPhySpeed());
+
+	mode = Emac3(SMAP_R_EMAC3_MODE0);
+	CHECK((mode & (SMAP_E3_TXMAC_ENABLE | SMAP_E3_RXMAC_ENABLE)) == (SMAP_E3_TXMAC_ENABLE | SMAP_E3_RXMAC_ENABLE), "boot: the MAC is not enabled (MODE0 0x%08x)", mode);
+	mode = Emac3(SMAP_R_EMAC3_MODE1);
+	CHECK((mode & (SMAP_E3_FDX_ENABLE | SMAP_E3_FLOWCTRL_ENABLE | SMAP_E3_ALLOW_PF)) == (SMAP_E3_FDX_ENABLE | SMAP_E3_FLOWCTRL_ENABLE | SMAP_E3_ALLOW_PF), "boot: MODE1 0x%08x", mode);
+
+	CHECK(SimNetif != NULL, "boot: no netif was added");
+	if(SimNetif == NULL) return;
+	CHECK((SimNetif->flags & (NETIF_FLAG_UP | NETIF_FLAG_LINK_UP)) == (NETIF_FLAG_UP | NETIF_FLAG_LINK_UP) && SimLinkUpCount == 1, "boot: the netif is not up (flags 0x%x)", SimNetif->flags);
+	CHECK(memcmp(SimNetif->hwaddr, SimMacAddress, 6) == 0, "boot: wrong MAC address");
+	CHECK(SimNetif->ip_addr.addr == inet_addr("192.168.0.10") && SimNetif->gw.addr == inet_addr("192.168.0.1"), "boot: wrong addresses");
+
+	//The library stays registered, which keeps the driver from being loaded twice.
+	CHECK(Load("") == MODULE_NO_RESIDENT_END, "boot: loaded twice");
+
+	//The link is checked from the third second without traffic on.
+	SimRun(5000000);
+	CHECK(SmapDriverData.LinkStatus && SmapDriverData.LinkStats.LinkDownCount == 0 && SimLinkDownCount == 0, "boot: the link was lost");
+	CheckNoLeaks("boot");
+}
+
+//Pause is resolved as per IEEE 802.3 Annex 28B, from what the PHY and the partner advertise.
+static const struct{
+	u16 partner;
+	unsigned char LinkMode;
+	u32 mode1;
+} PauseCases[] = {
+	{PARTNER_ALL,	0x48, SMAP_E3_FDX_ENABLE | SMAP_E3_FLOWCTRL_ENABLE | SMAP_E3_ALLOW_PF},
+	{0x0DE1,	0x48, SMAP_E3_FDX_ENABLE | SMAP_E3_FLOWCTRL_ENABLE | SMAP_E3_ALLOW_PF},	//Symmetric and asymmetric pause
+	{0x09E1,	0x48, SMAP_E3_FDX_ENABLE | SMAP_E3_ALLOW_PF},	//Asymmetric pause only: the partner sends pause frames, but does not obey them.
+	{0x01E1,	0x08, SMAP_E3_FDX_ENABLE},
+	{0x0461,	0x42, SMAP_E3_FDX_ENABLE | SMAP_E3_FLOWCTRL_ENABLE | SMAP_E3_ALLOW_PF},	//10BASE-T
+	{0x0421,	0x01, 0},	//10BASE-T half duplex, where pause does not apply.
+};
+
+static void TestPhyPauseCase(unsigned int index){
+	u32 mode;
+
+	SimReset();
+	SimPhyPartner = PauseCases[index].partner;
+	Load("");
+
+	mode = Emac3(SMAP_R_EMAC3_MODE1) & (SMAP_E3_FDX_ENABLE | SMAP_E3_FLOWCTRL_ENABLE | SMAP_E3_ALLOW_PF);
+	CHECK(SmapDriverData.LinkMode == PauseCases[index].LinkMode && mode == PauseCases[index].mode1, "pause: partner 0x%04x: link mode 0x%x and MODE1 0x%08x, expected 0x%x and 0x%08x",
+		PauseCases[index].partner, SmapDriverData.LinkMode, mode, PauseCases[index].LinkMode, PauseCases[index].mode1);
+}
+
+void TestPhyPause(unsigned int arg){
+	unsigned int i;
+
+	(void)arg;
+
+	for(i = 0; i < sizeof(PauseCases) / sizeof(PauseCases[0]); i++)
+		RunIsolated("pause", &TestPhyPauseCase, i);
+}
+
+//Without a cable, auto-negotiation is tried 3 times, 3s apart. Then 100Mbit/s half duplex is forced, and polled for 3s.
+void TestPhyFallback(unsigned int arg){
+	(void)arg;
+
+	SimReset();
+	SimPhyCable(0, 0);
+	SimPhyCable(1, 10500000);
+	Load("");
+
+	CHECK(Elapsed() >= 10500000 && Elapsed() < 11500000, "fallback: took %u ms", Elapsed() / 1000);
+	CHECK(SmapDriverData.LinkStatus && SmapDriverData.LinkMode == (4 | 0x40), "fallback: link mode 0x%x", SmapDriverData.LinkMode);
+	CHECK(SimPhySpeed() == 100, "fallback: the PHY runs at %u Mbit/s", SimPhySpeed());
+	CHECK(!(Emac3(SMAP_R_EMAC3_MODE1) & SMAP_E3_FDX_ENABLE), "fallback: the MAC is in full duplex");
+}
+
+//A link with receive errors is replaced by one at 10Mbit/s half duplex, without auto-negotiation.
+void TestPhyLinkErrors(unsigned int arg){
+	(void)arg;
+
+	SimReset();
+	SimPhyErrors = 5;
+	Load("");
+
+	CHECK(SmapDriverData.LinkStatus && (SmapDriverData.LinkMode & 0xF) == 1, "link errors: link mode 0x%x", SmapDriverData.LinkMode);
+	CHECK(SimPhySpeed() == 10, "link errors: the PHY runs at %u Mbit/s", SimPhySpeed());
+	CHECK(!(Emac3(SMAP_R_EMAC3_MODE1) & SMAP_E3_FDX_ENABLE), "link errors: the MAC is in full duplex");
+}
+
+static void TestPhyWarmStartCase(unsigned int warm){
+	SimReset();
+	SimPhyLinked();
+	Load(warm ? "-warm" : "");
+
+	CHECK(SmapDriverData.LinkStatus && SmapDriverData.LinkMode == (8 | 0x40), "warm: link mode 0x%x", SmapDriverData.LinkMode);
+	if(warm){
+		CHECK(Elapsed() < 100000 && SimPhyResets == 0, "warm: the link was not adopted (%u ms, %u resets)", Elapsed() / 1000, SimPhyResets);
+	}
+	else
+		CHECK(Elapsed() >= 3500000 && SimPhyResets == 1, "warm: the link was adopted without -warm");
+}
+
+void TestPhyWarmStart(unsigned int arg){
+	(void)arg;
+
+	RunIsolated("warm", &TestPhyWarmStartCase, 1);
+	RunIsolated("warm", &TestPhyWarmStartCase, 0);
+}
+
+/* Link loss */
+
+//The cable is pulled for 2s. The link is found to be down on the third link check, and returns without resetting the PHY.
+void TestLinkFastRelink(unsigned int arg){
+	static u8 frame[128];
+	const struct SmapLinkStats *stats;
+	unsigned int length;
+
+	(void)arg;
+
+	SimReset();
+	Load("");
+	stats = &SmapDriverData.LinkStats;
+
+	SimPhyCable(0, 500000);
+	SimPhyCable(1, 2500000);
+	SimRun(3500000);
+	CHECK(!SmapDriverData.LinkStatus && stats->LinkDownCount == 1 && SimLinkDownCount == 1, "fast relink: the link loss was not noticed");
+	length = BuildFrame(frame, FRAME_ACK, 1, 0);
+	CHECK(Send(frame, length) == ERR_CONN, "fast relink: a frame was accepted without a link");
+
+	SimRun(2000000);
+	CHECK(SmapDriverData.LinkStatus && SimLinkUpCount == 2, "fast relink: the link did not return");
+	CHECK(stats->FastRelinkCount == 1 && stats->FullRelinkCount == 0 && SimPhyResets == 1, "fast relink: %u fast and %u full relinks, %u PHY resets",
+		(unsigned int)stats->FastRelinkCount, (unsigned int)stats->FullRelinkCount, SimPhyResets);
+
+	//The outage lasts until the first frame is received.
+	SimRxFrame(frame, BuildFrame(frame, FRAME_UDP, 2, 100), 0);
+	CHECK(stats->LastOutage >= 1000000 && stats->LastOutage < 3000000 && stats->MaxOutage == stats->LastOutage, "fast relink: outage of %u ms", (unsigned int)stats->LastOutage / 1000);
+
+	CHECK(Send(frame, length) == ERR_OK, "fast relink: a frame was refused");
+	SimRun(10000);
+	CHECK(SimTxFrameCount == 1, "fast relink: %u frames sent", SimTxFrameCount);
+	CheckNoLeaks("fast relink");
+}
+
+//The cable is pulled for 5.5s. The PHY is reset once the link has not returned within 2s, while the Rx FIFO is still serviced.
+void TestLinkFullRelink(unsigned int arg){
+	static u8 frame[128];
+	const struct SmapLinkStats *stats;
+
+	(void)arg;
+
+	SimReset();
+	Load("");
+	stats = &SmapDriverData.LinkStats;
+
+	SimPhyCable(0, 500000);
+	SimPhyCable(1, 6000000);
+	SimRun(7000000);
+	CHECK(!SmapDriverData.LinkStatus && SmapDriverData.PhyState != SMAP_PHY_STATE_IDLE, "full relink: the PHY is not being brought up");
+	CHECK(stats->FullRelinkCount == 1 && stats->FastRelinkCount == 0 && SimPhyResets == 2, "full relink: %u fast and %u full relinks, %u PHY resets",
+		(unsigned int)stats->FastRelinkCount, (unsigned int)stats->FullRelinkCount, SimPhyResets);
+
+	SimRxFrame(frame, BuildFrame(frame, FRAME_UDP, 1, 100), 0);
+	SimTcpipRun();
+	CHECK(SimRxDeliveredCount == 1, "full relink: a frame was not received while the PHY was being brought up");
+
+	SimRun(3000000);
+	CHECK(SmapDriverData.LinkStatus && SimLinkUpCount == 2 && SimLinkDownCount == 1, "full relink: the link did not return");
+
+	SimRxFrame(frame, BuildFrame(frame, FRAME_UDP, 2, 100), 0);
+	CHECK(stats->LastOutage >= 5000000, "full relink: outage of %u ms", (unsigned int)stats->LastOutage / 1000);
+	CheckNoLeaks("full relink");
+}
+
+/* Interface */
+
+//The interface is stopped and started again, as by the network configuration of an application.
+void TestStopStart(unsigned int arg){
+	static u8 frame[128];
+	unsigned int length;
+	u64 time;
+
+	(void)arg;
+
+	SimReset();
+	Load("");
+	SimRun(10000);
+
+	SMAPStop();
+	SimTcpipRun();
+	CHECK(!SmapDriverData.LinkStatus && SimLinkDownCount == 1, "stop: the link is still up");
+	CHECK(!(Emac3(SMAP_R_EMAC3_MODE0) & (SMAP_E3_TXMAC_ENABLE | SMAP_E3_RXMAC_ENABLE)), "stop: the MAC is still enabled");
+	CHECK(SimPbufsInUse == 0, "stop: %d pbufs are still held", SimPbufsInUse);
+	length = BuildFrame(frame, FRAME_ACK, 1, 0);
+	CHECK(Send(frame, length) == ERR_CONN, "stop: a frame was accepted");
+
+	//The PHY is brought up by the interrupt handler thread, so starting does not block.
+	time = SimTime;
+	SMAPStart();
+	CHECK(!SmapDriverData.LinkStatus && SimTime == time, "stop: starting blocked");
+	SimRun(5000000);
+	CHECK(SmapDriverData.LinkStatus && SimLinkUpCount == 2 && SimPhyResets == 2, "stop: the link did not return after starting");
+	CHECK((Emac3(SMAP_R_EMAC3_MODE0) & (SMAP_E3_TXMAC_ENABLE | SMAP_E3_RXMAC_ENABLE)) == (SMAP_E3_TXMAC_ENABLE | SMAP_E3_RXMAC_ENABLE), "stop: the MAC was not enabled");
+	CHECK(Send(frame, length) == ERR_OK, "stop: a frame was refused");
+	SimRun(10000);
+	CHECK(SimTxFrameCount == 1, "stop: %u frames sent", SimTxFrameCount);
+
+	//Stopping while the PHY is being brought up cancels it.
+	SMAPStop();
+	SMAPStart();
+	SimRun(100000);
+	SMAPStop();
+	SimRun(5000000);
+	CHECK(!SmapDriverData.LinkStatus && SmapDriverData.PhyState == SMAP_PHY_STATE_IDLE && SimPhyResets == 3, "stop: the PHY was still brought up");
+	CHECK(SimPbufsInUse == 0, "stop: %d pbufs leaked", SimPbufsInUse);
+}
+
+void TestNetif(unsigned int arg){
+	ip4_addr_t group;
+	unsigned int i;
+	u32 hash;
+
+	(void)arg;
+
+	SimReset();
+	Load("-rxcsum");
+
+	CHECK(SimNetif->name[0] == 's' && SimNetif->name[1] == 'm' && SimNetif->mtu == 1500 && SimNetif->hwaddr_len == 6, "netif: not set up");
+	CHECK((SimNetif->flags & (NETIF_FLAG_ETHARP | NETIF_FLAG_BROADCAST | NETIF_FLAG_IGMP)) == (NETIF_FLAG_ETHARP | NETIF_FLAG_BROADCAST | NETIF_FLAG_IGMP), "netif: flags 0x%x", SimNetif->flags);
+	//With -rxcsum, the stack leaves the IPv4 header and TCP checksums of received frames to the driver.
+	CHECK(SimNetif->chksum_flags == (NETIF_CHECKSUM_ENABLE_ALL & ~(NETIF_CHECKSUM_CHECK_IP | NETIF_CHECKSUM_CHECK_TCP)), "netif: checksum flags 0x%x", SimNetif->chksum_flags);
+
+	//Joining a group lets its frames through the group hash of the EMAC3.
+	IP4_ADDR(&group, 224, 0, 0, 251);
+	CHECK(SimNetif->igmp_mac_filter != NULL && SimNetif->igmp_mac_filter(SimNetif, &group, NETIF_ADD_MAC_FILTER) == ERR_OK, "netif: the group was not joined");
+	for(i = 0, hash = 0; i < 4; i++)
+		hash |= Emac3(SMAP_R_EMAC3_GROUP_HASH1 + i * (SMAP_R_EMAC3_GROUP_HASH2 - SMAP_R_EMAC3_GROUP_HASH1));
+	CHECK(hash != 0, "netif: no bit of the group hash was set");
+	SimNetif->igmp_mac_filter(SimNetif, &group, NETIF_DEL_MAC_FILTER);
+	for(i = 0, hash = 0; i < 4; i++)
+		hash |= Emac3(SMAP_R_EMAC3_GROUP_HASH1 + i * (SMAP_R_EMAC3_GROUP_HASH2 - SMAP_R_EMAC3_GROUP_HASH1));
+	CHECK(hash == 0, "netif: the group hash was not cleared");
+}
+
+/* Rx */
+
+//Frames are received from the interrupt handler thread, woken up by RXEND.
+void TestRxIntr(unsigned int arg){
+	static u8 frames[13][256];
+	struct SmapStats stats;
+	unsigned int lengths[13], i;
+	int state;
+
+	(void)arg;
+
+	SimReset();
+	Load("");
+	SimRun(10000);
+
+	//Every frame wakes the interrupt handler thread up right away, as it has a higher priority than the tcpip-thread.
+	for(i = 0; i < 5; i++){
+		lengths[i] = BuildFrame(frames[i], FRAME_UDP, i, 60 + i * 40);
+		SimRxFrame(frames[i], lengths[i], 0);
+		CHECK(SmapDriverData.RuntimeStats.RxFrameCount == i + 1, "rx intr: frame %u was not received right away", i);
+	}
+	CHECK(SmapDriverData.RuntimeStats.RxBatchCount == 5, "rx intr: %u batches", (unsigned int)SmapDriverData.RuntimeStats.RxBatchCount);
+
+	//Frames that arrive while the thread cannot run are passed on in one batch.
+	CpuSuspendIntr(&state);
+	for(; i < 13; i++){
+		lengths[i] = BuildFrame(frames[i], FRAME_UDP, i, 60 + i * 10);
+		SimRxFrame(frames[i], lengths[i], 0);
+	}
+	CpuResumeIntr(state);
+	CHECK(SmapDriverData.RuntimeStats.RxBatchCount == 6 && SmapDriverData.RuntimeStats.RxBatchMax == 8, "rx intr: %u batches of up to %u frames",
+		(unsigned int)SmapDriverData.RuntimeStats.RxBatchCount, SmapDriverData.RuntimeStats.RxBatchMax);
+
+	SimTcpipRun();
+	CHECK(SimRxDeliveredCount == 13, "rx intr: %u frames delivered", SimRxDeliveredCount);
+	for(i = 0; i < 13 && i < SimRxDeliveredCount; i++)
+		//Like the original driver, the frames are passed on with their lengths rounded up to a whole number of words.
+		CHECK(SimRxDelivered[i]->tot_len == ((lengths[i] + 3) & ~3) && memcmp(SimRxDelivered[i]->payload, frames[i], lengths[i]) == 0, "rx intr: frame %u was corrupted", i);
+	CHECK((unsigned char)(SmapDriverData.RxRingFillIndex - SmapDriverData.RxRingIndex) == SMAP_RX_RING_SIZE, "rx intr: the Rx ring was not refilled");
+
+	CHECK(SMapGetStats(&stats, sizeof(stats)) == sizeof(stats) && stats.version == SMAP_STATS_VERSION && stats.RxFrames == 13, "rx intr: wrong statistics");
+	CheckNoLeaks("rx intr");
+}
+
+//With rxbudget, a pass that uses up the whole budget switches to polling, until a pass yields fewer than rxpoll frames.
+void TestRxPolling(unsigned int arg){
+	static u8 frames[17][256];
+	unsigned int lengths[17], i;
+	int state;
+
+	(void)arg;
+
+	SimReset();
+	Load("rxbudget=4 rxpoll=2");
+	SimRun(10000);
+
+	CpuSuspendIntr(&state);
+	for(i = 0; i < 16; i++){
+		lengths[i] = BuildFrame(frames[i], FRAME_UDP, i, 100 + i * 10);
+		SimRxFrame(frames[i], lengths[i], 0);
+	}
+	CpuResumeIntr(state);
+	CHECK(SmapDriverData.RxPolling && SmapDriverData.RuntimeStats.RxFrameCount == 4, "rx poll: not polling after a full pass");
+
+	SimRun(5000);
+	CHECK(!SmapDriverData.RxPolling && SmapDriverData.RuntimeStats.RxPollModeCount == 1, "rx poll: still polling");
+	CHECK(SmapDriverData.RuntimeStats.RxBatchMax == 4, "rx poll: a batch of %u frames", SmapDriverData.RuntimeStats.RxBatchMax);
+
+	//RXEND is enabled again.
+	lengths[i] = BuildFrame(frames[i], FRAME_UDP, i, 100);
+	SimRxFrame(frames[i], lengths[i], 0);
+	CHECK(SmapDriverData.RuntimeStats.RxFrameCount == 17, "rx poll: %u frames received", (unsigned int)SmapDriverData.RuntimeStats.RxFrameCount);
+
+	SimTcpipRun();
+	CHECK(SimRxDeliveredCount == 17, "rx poll: %u frames delivered", SimRxDeliveredCount);
+	for(i = 0; i < 17 && i < SimRxDeliveredCount; i++)
+		CHECK(memcmp(SimRxDelivered[i]->payload, frames[i], lengths[i]) == 0, "rx poll: frame %u was corrupted or out of order", i);
+	CheckNoLeaks("rx poll");
+}
+
+void TestRxPause(unsigned int arg){
+	(void)arg;
+
+	SimReset();
+	Load("");
+
+	SimEmac3PauseFrame();
+	SimEmac3PauseFrame();
+	CHECK(SmapDriverData.RuntimeStats.RxPauseIntrCount == 2, "rx pause: %u interrupts counted", (unsigned int)SmapDriverData.RuntimeStats.RxPauseIntrCount);
+	CHECK(!(Emac3(SMAP_R_EMAC3_INTR_STAT) & SMAP_E3_INTR_PF), "rx pause: the interrupt was not cleared");
+}
+
+/* Tx */
+
+//ARP frames and ACKs are sent ahead of the bulk data that is still queued.
+void TestTxClasses(unsigned int arg){
+	static const u16 order[] = {0, 1, 100, 101, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19};
+	static u8 frame[1514];
+	unsigned int i, length;
+
+	(void)arg;
+
+	SimReset();
+	Load("");
+	SimRun(10000);
+
+	//The first two fill the Tx FIFO, and the others wait in the queue. Only the first frame into an empty queue wakes the driver up.
+	for(i = 0; i < 20; i++){
+		length = BuildFrame(frame, FRAME_TCP, i, 1514);
+		CHECK(Send(frame, length) == ERR_OK, "tx classes: bulk frame %u was refused", i);
+	}
+	length = BuildFrame(frame, FRAME_ARP, 100, 0);
+	CHECK(Send(frame, length) == ERR_OK, "tx classes: the ARP frame was refused");
+	length = BuildFrame(frame, FRAME_ACK, 101, 0);
+	CHECK(Send(frame, length) == ERR_OK, "tx classes: the ACK was refused");
+
+	SimRun(100000);
+	CheckTxOrder("tx classes", order, sizeof(order) / sizeof(order[0]));
+	CHECK(SmapDriverData.RuntimeStats.TxClassFrameCount[SMAP_TX_CLASS_CONTROL] == 1 && SmapDriverData.RuntimeStats.TxClassFrameCount[SMAP_TX_CLASS_ACK] == 1
+		&& SmapDriverData.RuntimeStats.TxClassFrameCount[SMAP_TX_CLASS_BULK] == 20, "tx classes: frames were not classified");
+	CHECK(SmapDriverData.RuntimeStats.TxKickSkippedCount == 17, "tx classes: %u wakeups skipped", (unsigned int)SmapDriverData.RuntimeStats.TxKickSkippedCount);
+	CheckNoLeaks("tx classes");
+}
+
+/*	A UDP sender pushes frames as fast as the driver accepts them, over a 10Mbit/s link.
+	Once the byte queue limit has been derived from the rate of the link, no frame should wait much longer than TxLatency (4ms),
+	plus the frame that crosses the limit and the two frames that fit into the Tx FIFO.	*/
+#define BQL_FRAMES	(SIM_MAX_TX_FRAMES - 64)
+
+void TestTxQueueLimit(unsigned int arg){
+	static u64 SentTime[BQL_FRAMES];
+	static u8 frame[1514];
+	unsigned int i, sent, refused, length, sec, usec, latency, MaxLatency, MaxEarlyLatency;
+	u64 start, settled;
+	u16 id;
+	err_t result;
+
+	(void)arg;
+
+	SimReset();
+	SimPhyPartner = PARTNER_10M_FDX;
+	Load("");
+	CHECK(SimPhySpeed() == 10, "bql: the link runs at %u Mbit/s", SimPhySpeed());
+
+	//The limit is updated on every link-check tick, the first of which is 1s after the link came up.
+	start = SimTime;
+	settled = start + 1200000;
+	for(sent = 0, refused = 0; SimTime < start + 3000000 && sent < BQL_FRAMES; ){
+		length = BuildFrame(frame, FRAME_UDP, sent, 1514);
+		if((result = Send(frame, length)) == ERR_OK){
+			SentTime[sent++] = SimTime;
+			continue;
+		}
+
+		CHECK(result == ERR_MEM, "bql: a frame was refused with %d", result);
+		if(result != ERR_MEM) break;
+		//ARP frames are never refused because of the limit.
+		if(refused++ % 256 == 0){
+			length = BuildFrame(frame, FRAME_ARP, 0xFFFF, 0);
+			CHECK(Send(frame, length) == ERR_OK, "bql: an ARP frame was refused");
+		}
+		SimRun(1000);
+	}
+	SimRun(1000000);
+
+	CHECK(SimTxFrameCount <= SIM_MAX_TX_FRAMES, "bql: more frames were sent than logged");
+	for(i = 0, id = 0, MaxLatency = MaxEarlyLatency = 0; i < SimTxFrameCount && i < SIM_MAX_TX_FRAMES; i++){
+		if(FrameId(SimTxFrames[i].data) == 0xFFFF) continue;
+
+		CHECK(FrameId(SimTxFrames[i].data) == id, "bql: frame %u on the wire is %u", id, FrameId(SimTxFrames[i].data));
+		if(FrameId(SimTxFrames[i].data) != id) break;
+		latency = SimTxFrames[i].time - SentTime[id];
+		if(SentTime[id] >= settled){
+			if(latency > MaxLatency) MaxLatency = latency;
+		}
+		else if(latency > MaxEarlyLatency)
+			MaxEarlyLatency = latency;
+		id++;
+	}
+	CHECK(id == sent, "bql: %u of %u frames sent", id, sent);
+	CHECK(MaxLatency < 20000, "bql: a frame waited %u us", MaxLatency);
+	CHECK(SmapDriverData.RuntimeStats.TxQueueLimitCount == refused && refused > 0, "bql: %u frames refused, %u counted", refused, (unsigned int)SmapDriverData.RuntimeStats.TxQueueLimitCount);
+	CHECK(SmapDriverData.RuntimeStats.TxQueueFullCount == 0, "bql: the queue was full %u times", SmapDriverData.RuntimeStats.TxQueueFullCount);
+
+	sec = MaxEarlyLatency / 1000000;
+	usec = MaxEarlyLatency % 1000000;
+	REPORT("bql: %u frames at 10Mbit/s, up to %u.%03us before the first update and %uus after, with a limit of %u bytes", sent, sec, usec / 1000, MaxLatency,
+		(unsigned int)SmapDriverData.RuntimeStats.TxQueueLimit);
+	CheckNoLeaks("bql");
+}
+
+//With -tx_direct, frames are written into the Tx FIFO by the tcpip-thread while nothing is queued, and queued behind one another otherwise.
+void TestTxDirect(unsigned int arg){
+	static const u16 order[] = {1, 10, 11, 12, 13, 14, 15};
+	static u8 frame[1514];
+	unsigned int i, length;
+
+	(void)arg;
+
+	SimReset();
+	Load("-tx_direct");
+	SimRun(10000);
+
+	length = BuildFrame(frame, FRAME_ACK, 1, 0);
+	CHECK(Send(frame, length) == ERR_OK, "tx direct: the ACK was refused");
+	CHECK(SmapDriverData.RuntimeStats.TxDirectCount == 1 && SmapDriverData.RuntimeStats.TxKickCount == 0, "tx direct: the ACK was not sent directly");
+	SimRun(10000);
+	CHECK(SimTxFrameCount == 1, "tx direct: %u frames sent", SimTxFrameCount);
+
+	//Two fit into the Tx FIFO. The others are queued, and so are the frames that follow them, to keep the order.
+	for(i = 0; i < 6; i++){
+		length = BuildFrame(frame, FRAME_TCP, 10 + i, 1514);
+		CHECK(Send(frame, length) == ERR_OK, "tx direct: frame %u was refused", i);
+	}
+	CHECK(SmapDriverData.RuntimeStats.TxDirectCount == 3, "tx direct: %u frames sent directly", (unsigned int)SmapDriverData.RuntimeStats.TxDirectCount);
+
+	SimRun(50000);
+	CheckTxOrder("tx direct", order, sizeof(order) / sizeof(order[0]));
+	CheckNoLeaks("tx direct");
+}
+
+//With -txend, the Tx FIFO is refilled as every frame is sent.
+void TestTxEnd(unsigned int arg){
+	static const u16 order[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+	static u8 frame[1514];
+	unsigned int i, length;
+
+	(void)arg;
+
+	SimReset();
+	Load("-txend");
+	SimRun(10000);
+
+	for(i = 0; i < 10; i++){
+		length = BuildFrame(frame, FRAME_TCP, i, 1514);
+		Send(frame, length);
+	}
+	SimRun(10000);
+	CheckTxOrder("txend", order, sizeof(order) / sizeof(order[0]));
+	CHECK(SmapDriverData.RuntimeStats.TxEndIntrCount >= 8, "txend: %u TXEND interrupts", (unsigned int)SmapDriverData.RuntimeStats.TxEndIntrCount);
+	CheckNoLeaks("txend");
+}
+
+//Errors written back into the Tx BDs are counted.
+void TestTxErrors(unsigned int arg){
+	static u8 frame[128];
+	unsigned int length;
+
+	(void)arg;
+
+	SimReset();
+	Load("");
+	SimRun(10000);
+
+	SimTxErrors = SMAP_BD_TX_EDEFER;
+	length = BuildFrame(frame, FRAME_UDP, 1, 100);
+	Send(frame, length);
+	SimRun(10000);
+	CHECK(SmapDriverData.RuntimeStats.TxDroppedFrameCount == 1 && SmapDriverData.RuntimeStats.TxFrameEDEFERCount == 1, "tx errors: the excessive deferral was not counted");
+
+	//Until the next link check, frames are still sent without a link.
+	SimTxErrors = 0;
+	SimPhyCable(0, 0);
+	Send(frame, length);
+	SimRun(10000);
+	CHECK(SmapDriverData.RuntimeStats.TxDroppedFrameCount == 2 && SmapDriverData.RuntimeStats.TxFrameLOSSCRCount == 1, "tx errors: the loss of carrier was not counted");
+	CheckNoLeaks("tx errors");
+}
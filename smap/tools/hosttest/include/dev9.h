@@ -0,0 +1,18 @@
+/*	Host stand-in for the ps2sdk header of the same name. See ../sim.c.	*/
+#ifndef SIM_DEV9_H
+#define SIM_DEV9_H
+
+#include <tamtypes.h>
+
+typedef int (*dev9_intr_cb_t)(int flag);
+typedef void (*dev9_dma_cb_t)(int bcr, int dir);
+
+void dev9RegisterIntrCb(int intr, dev9_intr_cb_t cb);
+void dev9RegisterPreDmaCb(int ctrl, dev9_dma_cb_t cb);
+void dev9RegisterPostDmaCb(int ctrl, dev9_dma_cb_t cb);
+int dev9DmaTransfer(int ctrl, void *buf, int bcr, int dir);
+void dev9IntrEnable(int mask);
+void dev9IntrDisable(int mask);
+int dev9GetEEPROM(u16 *buf);
+
+#endif
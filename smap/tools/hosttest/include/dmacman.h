@@ -0,0 +1,8 @@
+/*	Host stand-in for the ps2sdk header of the same name. See ../sim.c.	*/
+#ifndef SIM_DMACMAN_H
+#define SIM_DMACMAN_H
+
+#define DMAC_TO_MEM	0
+#define DMAC_FROM_MEM	1
+
+#endif
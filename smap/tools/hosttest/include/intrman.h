@@ -0,0 +1,8 @@
+/*	Host stand-in for the ps2sdk header of the same name. See ../simos.c.	*/
+#ifndef SIM_INTRMAN_H
+#define SIM_INTRMAN_H
+
+int CpuSuspendIntr(int *state);
+int CpuResumeIntr(int state);
+
+#endif
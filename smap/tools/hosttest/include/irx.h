@@ -0,0 +1,21 @@
+/*	Host stand-in for the ps2sdk header of the same name. See ../simos.c.	*/
+#ifndef SIM_IRX_H
+#define SIM_IRX_H
+
+#include <tamtypes.h>
+
+#define MODULE_RESIDENT_END	0
+#define MODULE_NO_RESIDENT_END	1
+
+struct irx_export_table{
+	u32 magic;
+};
+
+struct irx_id{
+	const char *n;
+	u16 v;
+};
+
+#define IRX_ID(name, major, minor)	struct irx_id _irx_id = {name, (major) << 8 | (minor)}
+
+#endif
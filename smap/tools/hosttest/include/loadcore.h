@@ -0,0 +1,10 @@
+/*	Host stand-in for the ps2sdk header of the same name. See ../simos.c.	*/
+#ifndef SIM_LOADCORE_H
+#define SIM_LOADCORE_H
+
+#include <irx.h>
+
+int RegisterLibraryEntries(struct irx_export_table *exports);
+int ReleaseLibraryEntries(struct irx_export_table *exports);
+
+#endif
@@ -0,0 +1,7 @@
+/*	Host stand-in for the ps2sdk header of the same name. See ../simos.c.	*/
+#ifndef SIM_MODLOAD_H
+#define SIM_MODLOAD_H
+
+#include <irx.h>
+
+#endif
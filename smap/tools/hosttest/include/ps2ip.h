@@ -0,0 +1,117 @@
+/*	Host stand-in for the ps2sdk header of the same name, with the parts of lwIP that the driver uses. See ../simos.c.	*/
+#ifndef SIM_PS2IP_H
+#define SIM_PS2IP_H
+
+#include <tamtypes.h>
+
+typedef s8 err_t;
+
+struct pbuf{
+	struct pbuf *next;
+	void *payload;
+	u16 tot_len;
+	u16 len;
+	u8 type;
+	u8 flags;
+	u16 ref;
+};
+
+typedef enum{
+	PBUF_TRANSPORT,
+	PBUF_IP,
+	PBUF_LINK,
+	PBUF_RAW
+} pbuf_layer;
+
+typedef enum{
+	PBUF_RAM,
+	PBUF_ROM,
+	PBUF_REF,
+	PBUF_POOL
+} pbuf_type;
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, u16 length, pbuf_type type);
+void pbuf_realloc(struct pbuf *p, u16 size);
+u8 pbuf_free(struct pbuf *p);
+void pbuf_ref(struct pbuf *p);
+
+#define LWIP_IGMP			1
+#define LWIP_CHECKSUM_CTRL_PER_NETIF	1
+
+struct ip4_addr{
+	u32 addr;
+};
+
+typedef struct ip4_addr ip4_addr_t;
+
+//The address is stored in network byte order.
+#define IP4_ADDR(ipaddr, a, b, c, d)	((ipaddr)->addr = (u32)(a) | (u32)(b) << 8 | (u32)(c) << 16 | (u32)(d) << 24)
+
+u32 inet_addr(const char *cp);
+
+#define NETIF_MAX_HWADDR_LEN	6
+
+#define NETIF_FLAG_UP		0x01
+#define NETIF_FLAG_BROADCAST	0x02
+#define NETIF_FLAG_LINK_UP	0x04
+#define NETIF_FLAG_ETHARP	0x08
+#define NETIF_FLAG_ETHERNET	0x10
+#define NETIF_FLAG_IGMP		0x20
+
+#define NETIF_CHECKSUM_GEN_IP		0x0001
+#define NETIF_CHECKSUM_GEN_UDP		0x0002
+#define NETIF_CHECKSUM_GEN_TCP		0x0004
+#define NETIF_CHECKSUM_CHECK_IP		0x0100
+#define NETIF_CHECKSUM_CHECK_UDP	0x0200
+#define NETIF_CHECKSUM_CHECK_TCP	0x0400
+#define NETIF_CHECKSUM_ENABLE_ALL	0xFFFF
+
+#define NETIF_SET_CHECKSUM_CTRL(netif, chksumflags)	((netif)->chksum_flags = (chksumflags))
+
+enum netif_mac_filter_action{
+	NETIF_DEL_MAC_FILTER = 0,
+	NETIF_ADD_MAC_FILTER = 1
+};
+
+struct netif;
+
+typedef err_t (*netif_init_fn)(struct netif *netif);
+typedef err_t (*netif_input_fn)(struct pbuf *p, struct netif *inp);
+typedef err_t (*netif_output_fn)(struct netif *netif, struct pbuf *p, const ip4_addr_t *ipaddr);
+typedef err_t (*netif_linkoutput_fn)(struct netif *netif, struct pbuf *p);
+typedef err_t (*netif_igmp_mac_filter_fn)(struct netif *netif, const ip4_addr_t *group, enum netif_mac_filter_action action);
+
+struct netif{
+	struct netif *next;
+	ip4_addr_t ip_addr;
+	ip4_addr_t netmask;
+	ip4_addr_t gw;
+	netif_input_fn input;
+	netif_output_fn output;
+	netif_linkoutput_fn linkoutput;
+	void *state;
+	u16 mtu;
+	u8 hwaddr_len;
+	u8 hwaddr[NETIF_MAX_HWADDR_LEN];
+	u8 flags;
+	char name[2];
+	u16 chksum_flags;
+	netif_igmp_mac_filter_fn igmp_mac_filter;
+};
+
+struct netif *netif_add(struct netif *netif, const ip4_addr_t *ipaddr, const ip4_addr_t *netmask, const ip4_addr_t *gw, void *state, netif_init_fn init, netif_input_fn input);
+void netif_set_default(struct netif *netif);
+void netif_set_up(struct netif *netif);
+void netif_set_link_up(struct netif *netif);
+void netif_set_link_down(struct netif *netif);
+
+err_t etharp_output(struct netif *netif, struct pbuf *q, const ip4_addr_t *ipaddr);
+err_t ethernet_input(struct pbuf *p, struct netif *netif);
+
+typedef void (*tcpip_callback_fn)(void *ctx);
+
+err_t tcpip_input(struct pbuf *p, struct netif *inp);
+err_t tcpip_callback_with_block(tcpip_callback_fn function, void *ctx, u8 block);
+#define tcpip_callback(f, ctx)	tcpip_callback_with_block(f, ctx, 1)
+
+#endif
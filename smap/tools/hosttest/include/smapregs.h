@@ -0,0 +1,177 @@
+/*	Host stand-in for the ps2sdk header of the same name. See ../sim.c.
+	The register offsets and bits are those that the driver refers to. Every register access goes through SimRegister(),
+	so that the model can move the FIFO pointers and count the accesses across the DEV9 bus. The EMAC3 registers are accessed through functions,
+	so that the model can act on every write.	*/
+#ifndef SIM_SMAPREGS_H
+#define SIM_SMAPREGS_H
+
+#include <tamtypes.h>
+
+extern u8 SimSmapRegs[], SimEmac3Regs[];
+volatile void *SimRegister(volatile u8 *base, unsigned int offset, unsigned int size);
+u32 SimEmac3Read(volatile u8 *base, unsigned int offset);
+void SimEmac3Write(volatile u8 *base, unsigned int offset, u32 value);
+
+#define USE_SMAP_REGS		volatile u8 *smap_regbase = SimSmapRegs
+#define USE_SMAP_EMAC3_REGS	volatile u8 *emac3_regbase = SimEmac3Regs
+
+#define SMAP_REG8(offset)	(*(volatile u8*)SimRegister(smap_regbase, (offset), 1))
+#define SMAP_REG16(offset)	(*(volatile u16*)SimRegister(smap_regbase, (offset), 2))
+#define SMAP_REG32(offset)	(*(volatile u32*)SimRegister(smap_regbase, (offset), 4))
+#define SMAP_EMAC3_GET32(offset)	SimEmac3Read(emac3_regbase, (offset))
+#define SMAP_EMAC3_SET32(offset, value)	SimEmac3Write(emac3_regbase, (offset), (value))
+
+typedef struct{
+	u16 ctrl_stat;
+	u16 reserved;
+	u16 length;
+	u16 pointer;
+} smap_bd_t;
+
+extern smap_bd_t SimTxBD[], SimRxBD[];
+
+#define USE_SMAP_TX_BD	volatile smap_bd_t *tx_bd = SimTxBD
+#define USE_SMAP_RX_BD	volatile smap_bd_t *rx_bd = SimRxBD
+
+#define SMAP_BD_MAX_ENTRY	64
+#define SMAP_TX_BASE		0x1000
+#define SMAP_TX_BUFSIZE		4096
+#define SMAP_RX_BASE		0x4000
+#define SMAP_RX_BUFSIZE		16384
+#define SMAP_R_INTR_CLR		0x128
+#define SMAP_R_BD_MODE		0x102
+#define SMAP_R_TXFIFO_CTRL	0x1000
+#define SMAP_TXFIFO_RESET	1
+#define SMAP_TXFIFO_DMAEN	2
+#define SMAP_R_TXFIFO_WR_PTR	0x1004
+#define SMAP_R_TXFIFO_SIZE	0x1008
+#define SMAP_R_TXFIFO_FRAME_CNT	0x100C
+#define SMAP_R_TXFIFO_FRAME_INC	0x1010
+#define SMAP_R_TXFIFO_DATA	0x1100
+#define SMAP_R_RXFIFO_CTRL	0x1030
+#define SMAP_RXFIFO_RESET	1
+#define SMAP_RXFIFO_DMAEN	2
+#define SMAP_R_RXFIFO_RD_PTR	0x1034
+#define SMAP_R_RXFIFO_SIZE	0x1038
+#define SMAP_R_RXFIFO_FRAME_CNT	0x103C
+#define SMAP_R_RXFIFO_FRAME_DEC	0x1040
+#define SMAP_R_RXFIFO_DATA	0x1200
+#define SMAP_INTR_EMAC3		(1<<6)
+#define SMAP_INTR_RXEND		(1<<5)
+#define SMAP_INTR_TXEND		(1<<4)
+#define SMAP_INTR_RXDNV		(1<<3)
+#define SMAP_INTR_TXDNV		(1<<2)
+#define SMAP_BD_TX_READY	(1<<15)
+#define SMAP_BD_TX_GENFCS	(1<<9)
+#define SMAP_BD_TX_GENPAD	(1<<8)
+#define SMAP_BD_TX_LOSSCR	(1<<7)
+#define SMAP_BD_TX_EDEFER	(1<<6)
+#define SMAP_BD_TX_ECOLL	(1<<5)
+#define SMAP_BD_TX_LCOLL	(1<<4)
+#define SMAP_BD_TX_MCOLL	(1<<3)
+#define SMAP_BD_TX_SCOLL	(1<<2)
+#define SMAP_BD_TX_UNDERRUN	(1<<1)
+#define SMAP_BD_RX_EMPTY	(1<<15)
+#define SMAP_BD_RX_OVERRUN	(1<<9)
+#define SMAP_BD_RX_PFRM		(1<<8)
+#define SMAP_BD_RX_BADFRM	(1<<7)
+#define SMAP_BD_RX_RUNTFRM	(1<<6)
+#define SMAP_BD_RX_SHORTEVNT	(1<<5)
+#define SMAP_BD_RX_ALIGNERR	(1<<4)
+#define SMAP_BD_RX_BADFCS	(1<<3)
+#define SMAP_BD_RX_FRMTOOLONG	(1<<2)
+#define SMAP_BD_RX_OUTRANGE	(1<<1)
+#define SMAP_BD_RX_INRANGE	(1<<0)
+#define SMAP_R_EMAC3_MODE0	0x0
+#define SMAP_E3_RXMAC_IDLE	(1<<31)
+#define SMAP_E3_TXMAC_IDLE	(1<<30)
+#define SMAP_E3_SOFT_RESET	(1<<29)
+#define SMAP_E3_TXMAC_ENABLE	(1<<28)
+#define SMAP_E3_RXMAC_ENABLE	(1<<27)
+#define SMAP_R_EMAC3_MODE1	0x4
+#define SMAP_E3_FDX_ENABLE	(1u<<31)
+#define SMAP_E3_INLPBK_ENABLE	(1<<30)
+#define SMAP_E3_FLOWCTRL_ENABLE	(1<<28)
+#define SMAP_E3_ALLOW_PF	(1<<27)
+#define SMAP_E3_IGNORE_SQE	(1<<24)
+#define SMAP_E3_MEDIA_100M	(1<<22)
+#define SMAP_E3_MEDIA_MSK	(3<<22)
+#define SMAP_E3_RXFIFO_2K	(2<<20)
+#define SMAP_E3_TXFIFO_1K	(1<<18)
+#define SMAP_E3_TXREQ0_MULTI	(1<<15)
+#define SMAP_E3_TXREQ1_SINGLE	0
+#define SMAP_R_EMAC3_TxMODE0	0x8
+#define SMAP_E3_TX_GNP_0	(1u<<31)
+#define SMAP_R_EMAC3_TxMODE1	0xC
+#define SMAP_E3_TX_LOW_REQ_MSK	0x1F
+#define SMAP_E3_TX_LOW_REQ_BITSFT	27
+#define SMAP_E3_TX_URG_REQ_MSK	0xFF
+#define SMAP_E3_TX_URG_REQ_BITSFT	16
+#define SMAP_R_EMAC3_RxMODE	0x10
+#define SMAP_E3_RX_STRIP_PAD	(1u<<31)
+#define SMAP_E3_RX_STRIP_FCS	(1<<30)
+#define SMAP_E3_RX_PROMISC_MCAST	(1<<23)
+#define SMAP_E3_RX_INDIVID_ADDR	(1<<22)
+#define SMAP_E3_RX_BCAST	(1<<20)
+#define SMAP_E3_RX_MCAST	(1<<19)
+#define SMAP_R_EMAC3_INTR_STAT	0x14
+#define SMAP_R_EMAC3_INTR_ENABLE	0x18
+#define SMAP_E3_INTR_PF		(1<<24)
+#define SMAP_E3_INTR_DEAD_0	(1<<8)
+#define SMAP_E3_INTR_SQE_ERR_0	(1<<7)
+#define SMAP_E3_INTR_TX_ERR_0	(1<<6)
+#define SMAP_R_EMAC3_ADDR_HI	0x1C
+#define SMAP_R_EMAC3_ADDR_LO	0x20
+#define SMAP_R_EMAC3_PAUSE_TIMER	0x2C
+#define SMAP_R_EMAC3_GROUP_HASH1	0x40
+#define SMAP_R_EMAC3_GROUP_HASH2	0x44
+#define SMAP_R_EMAC3_GROUP_HASH3	0x48
+#define SMAP_R_EMAC3_GROUP_HASH4	0x4C
+#define SMAP_R_EMAC3_INTER_FRAME_GAP	0x58
+#define SMAP_R_EMAC3_STA_CTRL	0x5C
+#define SMAP_E3_PHY_DATA_BITSFT	16
+#define SMAP_E3_PHY_OP_COMP	(1<<15)
+#define SMAP_E3_PHY_READ	(1<<12)
+#define SMAP_E3_PHY_WRITE	(2<<12)
+#define SMAP_E3_PHY_ADDR_MSK	0x1F
+#define SMAP_E3_PHY_ADDR_BITSFT	5
+#define SMAP_E3_PHY_REG_ADDR_MSK	0x1F
+#define SMAP_R_EMAC3_TX_THRESHOLD	0x60
+#define SMAP_E3_TX_THRESHLD_MSK	0x1F
+#define SMAP_E3_TX_THRESHLD_BITSFT	27
+#define SMAP_R_EMAC3_RX_WATERMARK	0x64
+#define SMAP_E3_RX_LO_WATER_MSK	0x1FF
+#define SMAP_E3_RX_LO_WATER_BITSFT	23
+#define SMAP_E3_RX_HI_WATER_MSK	0x1FF
+#define SMAP_E3_RX_HI_WATER_BITSFT	7
+#define SMAP_DsPHYTER_ADDRESS	1
+#define SMAP_DsPHYTER_BMCR	0
+#define SMAP_DsPHYTER_BMSR	1
+#define SMAP_DsPHYTER_PHYIDR1	2
+#define SMAP_DsPHYTER_PHYIDR2	3
+#define SMAP_DsPHYTER_ANAR	4
+#define SMAP_DsPHYTER_ANLPAR	5
+#define SMAP_DsPHYTER_FCSCR	0x14
+#define SMAP_DsPHYTER_RECR	0x15
+#define SMAP_DsPHYTER_PHYCTRL	0x19
+#define SMAP_DsPHYTER_10BTSCR	0x1A
+#define SMAP_PHY_BMCR_RST	(1<<15)
+#define SMAP_PHY_BMCR_100M	(1<<13)
+#define SMAP_PHY_BMCR_10M	0
+#define SMAP_PHY_BMCR_ANEN	(1<<12)
+#define SMAP_PHY_BMCR_RSAN	(1<<9)
+#define SMAP_PHY_BMCR_DUPM	(1<<8)
+#define SMAP_PHY_BMSR_ANCP	(1<<5)
+#define SMAP_PHY_BMSR_LINK	(1<<2)
+#define SMAP_PHY_ANAR_TX_FD	(1<<8)
+#define SMAP_PHY_ANAR_TX	(1<<7)
+#define SMAP_PHY_ANAR_10_FD	(1<<6)
+#define SMAP_PHY_ANAR_10	(1<<5)
+#define SMAP_PHY_IDR1_VAL	0x2000
+#define SMAP_PHY_IDR2_VAL	0x5C20
+#define SMAP_PHY_IDR2_MSK	0xFFF0
+#define SMAP_PHY_IDR2_REV_MSK	0xF
+#define SMAP_PHY_10BTSCR_LOOPBACK_10_DIS	(1<<8)
+#define SMAP_PHY_10BTSCR_2	(1<<2)
+
+#endif
@@ -0,0 +1,21 @@
+/*	Host stand-in for the ps2sdk header of the same name. See ../sim.c.	*/
+#ifndef SIM_SPEEDREGS_H
+#define SIM_SPEEDREGS_H
+
+#include <tamtypes.h>
+
+extern u8 SimSpdRegs[];
+volatile void *SimRegister(volatile u8 *base, unsigned int offset, unsigned int size);
+
+#define USE_SPD_REGS	volatile u8 *spd_regbase = SimSpdRegs
+
+#define SPD_REG8(offset)	(*(volatile u8*)SimRegister(spd_regbase, (offset), 1))
+#define SPD_REG16(offset)	(*(volatile u16*)SimRegister(spd_regbase, (offset), 2))
+
+#define SPD_R_REV_1		0x02
+#define SPD_R_REV_3		0x04
+#define SPD_R_INTR_STAT		0x28
+
+#define SPD_CAPS_SMAP		0x01
+
+#endif
@@ -0,0 +1,9 @@
+/*	Host stand-in for the ps2sdk header of the same name. See ../sim.c.	*/
+#ifndef SIM_SYSCLIB_H
+#define SIM_SYSCLIB_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#endif
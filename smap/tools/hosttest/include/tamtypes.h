@@ -0,0 +1,16 @@
+/*	Host stand-in for the ps2sdk header of the same name. See ../sim.c.	*/
+#ifndef SIM_TAMTYPES_H
+#define SIM_TAMTYPES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+
+#endif
@@ -0,0 +1,33 @@
+/*	Host stand-in for the ps2sdk header of the same name. See ../simos.c.	*/
+#ifndef SIM_THBASE_H
+#define SIM_THBASE_H
+
+#include <tamtypes.h>
+
+typedef struct{
+	u32 lo, hi;
+} iop_sys_clock_t;
+
+typedef struct{
+	u32 attr;
+	u32 option;
+	void *thread;
+	u32 stacksize;
+	u32 priority;
+} iop_thread_t;
+
+#define TH_C	0x02000000
+
+int CreateThread(iop_thread_t *thread);
+int DeleteThread(int thid);
+int StartThread(int thid, void *arg);
+int DelayThread(int usec);
+int GetThreadId(void);
+
+int SetAlarm(iop_sys_clock_t *clock, unsigned int (*handler)(void *arg), void *arg);
+int CancelAlarm(unsigned int (*handler)(void *arg), void *arg);
+void GetSystemTime(iop_sys_clock_t *clock);
+void USec2SysClock(u32 usec, iop_sys_clock_t *clock);
+void SysClock2USec(iop_sys_clock_t *clock, u32 *sec, u32 *usec);
+
+#endif
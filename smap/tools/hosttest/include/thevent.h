@@ -0,0 +1,24 @@
+/*	Host stand-in for the ps2sdk header of the same name. See ../simos.c.	*/
+#ifndef SIM_THEVENT_H
+#define SIM_THEVENT_H
+
+#include <tamtypes.h>
+
+typedef struct{
+	u32 attr;
+	u32 option;
+	u32 bits;
+} iop_event_t;
+
+#define WEF_OR		1
+#define WEF_CLEAR	0x10
+
+int CreateEventFlag(iop_event_t *event);
+int DeleteEventFlag(int ef);
+int SetEventFlag(int ef, u32 bits);
+int iSetEventFlag(int ef, u32 bits);
+int ClearEventFlag(int ef, u32 bits);
+int WaitEventFlag(int ef, u32 bits, int mode, u32 *result);
+int PollEventFlag(int ef, u32 bits, int mode, u32 *result);
+
+#endif
@@ -0,0 +1,5 @@
+/*	Host stand-in for the ps2sdk header of the same name. See ../simos.c.	*/
+#ifndef SIM_THSEMAP_H
+#define SIM_THSEMAP_H
+
+#endif
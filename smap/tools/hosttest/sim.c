@@ -0,0 +1,706 @@
+/*	Model of the SMAP hardware that the driver uses, for running the driver on the host. The kernel and ps2ip are modelled in simos.c.
+	The driver sources (main.c, smap.c and xfer.c) are built unmodified against the headers in include/, which stand in for the ps2sdk ones.
+
+	Modelled:
+		- the register blocks, as plain memory. Reads and writes of the FIFO data ports move the FIFO pointers, and reading the Rx frame count
+		  returns the number of Rx BDs that hold a frame. Writes to the interrupt clear register and the FIFO resets take effect
+		  by the next register access, and DMA completes by then.
+		- the Tx and Rx BD tables.
+		- the 4KB Tx and 16KB Rx FIFOs, including the wrap-around at their ends. Reading the Rx FIFO past the last frame stored is recorded.
+		- the SMAP interrupt status, the DEV9 interrupt mask and the interrupt handlers registered with DEV9.
+		- dev9DmaTransfer(), which calls the DMA handlers registered with DEV9, and copies between memory and the FIFO selected by the direction.
+		- the EEPROM, which holds SimMacAddress.
+		- the EMAC3: its soft reset, its interrupt status for pause frames, and the MII management interface to the PHY.
+		  Tx channel 0 sends the frames of the Tx BDs that are ready, in order and at the speed of the link, once GNP has been written.
+		  TXEND is raised for every frame sent, and TXDNV once the next Tx BD is not ready.
+		- the DP83846A PHY and the link partner: reset, auto-negotiation, forced modes, the link status (latching low), the cable and receive errors.
+		- pbufs, with PBUF_POOL buffers of a configurable size.
+	Not modelled: the Rx side of the EMAC3 (the tests store frames with SimRxFrame()), collisions, the Tx FIFO space and the bus timing.	*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dev9.h>
+#include <dmacman.h>
+#include <intrman.h>
+#include <smapregs.h>
+#include <speedregs.h>
+#include <ps2ip.h>
+
+#include "sim.h"
+
+#define SIM_REGS_SIZE	0x2000
+#define SIM_PBUF_SLACK	256	//Bytes after every payload, for transfers that are padded to whole DMA blocks.
+#define SIM_PHY_EVENTS	8
+
+u8 SimSmapRegs[SIM_REGS_SIZE] __attribute__((aligned(4)));
+u8 SimEmac3Regs[SIM_REGS_SIZE] __attribute__((aligned(4)));
+u8 SimSpdRegs[SIM_REGS_SIZE] __attribute__((aligned(4)));
+smap_bd_t SimTxBD[SMAP_BD_MAX_ENTRY], SimRxBD[SMAP_BD_MAX_ENTRY];
+const u8 SimMacAddress[6] = {0x00, 0x04, 0x1F, 0x12, 0x34, 0x56};
+
+static u8 SimTxFifo[SMAP_TX_BUFSIZE] __attribute__((aligned(4)));
+static u8 SimRxFifo[SMAP_RX_BUFSIZE] __attribute__((aligned(4)));
+static unsigned int SimTxFifoWrPtr, SimRxFifoWrPtr, SimRxBDIndex;
+
+//The last register accessed, if writing to it has a side effect.
+static volatile u8 *SimPendingBase;
+static unsigned int SimPendingOffset;
+
+static u16 SimIntrStat, SimIntrMask;
+static dev9_intr_cb_t SimIntrCb[16];
+static dev9_dma_cb_t SimPreDmaCb, SimPostDmaCb;
+
+static unsigned int SimTxBDIndex;
+static int SimTxBusy;
+static u64 SimTxDoneTime;
+
+unsigned int SimRegAccesses, SimDmaBytes, SimRxOverreads;
+unsigned int SimPbufPoolBufSize = 1536;
+int SimPbufsInUse;
+struct pbuf *SimRxDelivered[SIM_MAX_FRAMES];
+unsigned int SimRxDeliveredCount;
+struct SimTxFrame SimTxFrames[SIM_MAX_TX_FRAMES];
+unsigned int SimTxFrameCount;
+u16 SimTxErrors;
+
+/* PHY */
+u16 SimPhyPartner, SimPhyErrors;
+unsigned int SimPhyResets;
+
+static u16 SimPhyRegs[32];
+static int SimPhyCableIn, SimPhyLink, SimPhyLinkFailed, SimPhyAutoNego, SimPhy100M;
+static u64 SimPhyLinkTime;	//When the link comes up, or 0 if it does not.
+static struct{
+	u64 time;
+	int connected;
+} SimPhyEvents[SIM_PHY_EVENTS];
+static unsigned int SimPhyEventCount;
+
+#define SIM_PHY_BMSR	0x7809	//100BASE-TX and 10BASE-T in both duplex modes, auto-negotiation ability and extended capabilities.
+#define SIM_PHY_IDR2	0x5C20	//Revision 0, which gets the extra initialization.
+
+static void SimPhyPowerOn(void){
+	memset(SimPhyRegs, 0, sizeof(SimPhyRegs));
+	SimPhyRegs[SMAP_DsPHYTER_BMCR] = SMAP_PHY_BMCR_ANEN | SMAP_PHY_BMCR_100M | SMAP_PHY_BMCR_DUPM;	//As strapped on the PS2.
+	SimPhyRegs[SMAP_DsPHYTER_ANAR] = 0x01E1;
+}
+
+//Restarts link establishment, like when the mode is changed or the cable is plugged in.
+static void SimPhyRestart(void){
+	if(SimPhyLink) SimPhyLinkFailed = 1;
+	SimPhyLink = 0;
+	SimPhyAutoNego = 0;
+	SimPhyRegs[SMAP_DsPHYTER_ANLPAR] = 0;
+	if(SimPhyCableIn)
+		SimPhyLinkTime = SimTime + ((SimPhyRegs[SMAP_DsPHYTER_BMCR] & SMAP_PHY_BMCR_ANEN) ? SIM_PHY_AUTONEGO_TIME : SIM_PHY_LINK_TIME);
+	else
+		SimPhyLinkTime = 0;
+}
+
+static void SimPhyLinkUp(void){
+	u16 common, bmcr;
+
+	SimPhyLinkTime = 0;
+	bmcr = SimPhyRegs[SMAP_DsPHYTER_BMCR];
+	if(bmcr & SMAP_PHY_BMCR_ANEN){
+		common = SimPhyRegs[SMAP_DsPHYTER_ANAR] & SimPhyPartner & 0x1E0;
+		if(common == 0) return;
+		SimPhy100M = (common & 0x180) != 0;
+		SimPhyAutoNego = 1;
+		SimPhyRegs[SMAP_DsPHYTER_ANLPAR] = SimPhyPartner | 0x4000;	//Acknowledge
+	}
+	else{
+		//The partner detects the speed, as long as it supports it.
+		SimPhy100M = (bmcr & SMAP_PHY_BMCR_100M) != 0;
+		if(!(SimPhyPartner & (SimPhy100M ? 0x180 : 0x060))) return;
+	}
+	SimPhyLink = 1;
+}
+
+static void SimPhyAdvance(void){
+	unsigned int i;
+
+	while(SimPhyEventCount > 0 && SimPhyEvents[0].time <= SimTime){
+		SimPhyCableIn = SimPhyEvents[0].connected;
+		for(i = 1; i < SimPhyEventCount; i++)
+			SimPhyEvents[i - 1] = SimPhyEvents[i];
+		SimPhyEventCount--;
+
+		if(SimPhyCableIn)
+			SimPhyRestart();
+		else{
+			if(SimPhyLink) SimPhyLinkFailed = 1;
+			SimPhyLink = 0;
+			SimPhyAutoNego = 0;
+			SimPhyLinkTime = 0;
+			SimPhyRegs[SMAP_DsPHYTER_ANLPAR] = 0;
+		}
+	}
+
+	if(SimPhyLinkTime != 0 && SimPhyLinkTime <= SimTime)
+		SimPhyLinkUp();
+}
+
+void SimPhyCable(int connected, unsigned int delay){
+	unsigned int i;
+
+	if(SimPhyEventCount >= SIM_PHY_EVENTS){
+		fprintf(stderr, "sim: too many cable events\n");
+		abort();
+	}
+
+	//Keep the events in order of time.
+	for(i = SimPhyEventCount; i > 0 && SimPhyEvents[i - 1].time > SimTime + delay; i--)
+		SimPhyEvents[i] = SimPhyEvents[i - 1];
+	SimPhyEvents[i].time = SimTime + delay;
+	SimPhyEvents[i].connected = connected;
+	SimPhyEventCount++;
+
+	SimPhyAdvance();
+}
+
+void SimPhyLinked(void){
+	SimPhyRegs[SMAP_DsPHYTER_BMCR] = SMAP_PHY_BMCR_ANEN;
+	SimPhyRegs[SMAP_DsPHYTER_ANAR] = 0x0DE1;
+	SimPhyCableIn = 1;
+	SimPhyLinkUp();
+	SimPhyLinkFailed = 0;
+}
+
+unsigned int SimPhySpeed(void){
+	return SimPhyLink ? (SimPhy100M ? 100 : 10) : 0;
+}
+
+static u16 SimPhyRead(unsigned int reg){
+	u16 value;
+
+	SimPhyAdvance();
+	switch(reg){
+		case SMAP_DsPHYTER_BMSR:
+			value = SIM_PHY_BMSR;
+			if(SimPhyAutoNego) value |= SMAP_PHY_BMSR_ANCP;
+			if(SimPhyLink && !SimPhyLinkFailed) value |= SMAP_PHY_BMSR_LINK;
+			SimPhyLinkFailed = 0;
+			return value;
+		case SMAP_DsPHYTER_PHYIDR1:
+			return SMAP_PHY_IDR1_VAL;
+		case SMAP_DsPHYTER_PHYIDR2:
+			return SIM_PHY_IDR2;
+		case SMAP_DsPHYTER_FCSCR:
+			return 0;
+		case SMAP_DsPHYTER_RECR:
+			return (SimPhyLink && SimPhyAutoNego) ? SimPhyErrors : 0;
+		default:
+			return SimPhyRegs[reg];
+	}
+}
+
+static void SimPhyWrite(unsigned int reg, u16 value){
+	u16 previous;
+
+	SimPhyAdvance();
+	switch(reg){
+		case SMAP_DsPHYTER_BMCR:
+			if(value & SMAP_PHY_BMCR_RST){
+				SimPhyResets++;
+				SimPhyPowerOn();
+				SimPhyRestart();
+				break;
+			}
+
+			previous = SimPhyRegs[reg];
+			SimPhyRegs[reg] = value & ~SMAP_PHY_BMCR_RSAN;
+			if(((previous ^ value) & (SMAP_PHY_BMCR_ANEN | SMAP_PHY_BMCR_100M | SMAP_PHY_BMCR_DUPM)) != 0
+				|| ((value & SMAP_PHY_BMCR_RSAN) && (value & SMAP_PHY_BMCR_ANEN)))
+				SimPhyRestart();
+			break;
+		case SMAP_DsPHYTER_BMSR:
+		case SMAP_DsPHYTER_PHYIDR1:
+		case SMAP_DsPHYTER_PHYIDR2:
+		case SMAP_DsPHYTER_ANLPAR:
+			break;
+		default:
+			SimPhyRegs[reg] = value;
+	}
+}
+
+/* Registers */
+
+void SimReset(void){
+	unsigned int i;
+
+	SimTcpipRun();
+	for(i = 0; i < SimRxDeliveredCount; i++)
+		pbuf_free(SimRxDelivered[i]);
+	SimRxDeliveredCount = 0;
+	SimKernelReset();
+
+	memset(SimSmapRegs, 0, sizeof(SimSmapRegs));
+	memset(SimEmac3Regs, 0, sizeof(SimEmac3Regs));
+	memset(SimSpdRegs, 0, sizeof(SimSpdRegs));
+	memset(SimTxFifo, 0, sizeof(SimTxFifo));
+	memset(SimRxFifo, 0, sizeof(SimRxFifo));
+	for(i = 0; i < SMAP_BD_MAX_ENTRY; i++){
+		memset(&SimTxBD[i], 0, sizeof(SimTxBD[i]));
+		memset(&SimRxBD[i], 0, sizeof(SimRxBD[i]));
+		SimRxBD[i].ctrl_stat = SMAP_BD_RX_EMPTY;
+	}
+	*(u16*)&SimSpdRegs[SPD_R_REV_1] = 0x11;
+	*(u16*)&SimSpdRegs[SPD_R_REV_3] = SPD_CAPS_SMAP;
+	SimTxFifoWrPtr = 0;
+	SimRxFifoWrPtr = 0;
+	SimRxBDIndex = 0;
+	SimPendingBase = NULL;
+	SimIntrStat = 0;
+	SimIntrMask = 0;
+	memset(SimIntrCb, 0, sizeof(SimIntrCb));
+	SimPreDmaCb = SimPostDmaCb = NULL;
+	SimTxBDIndex = 0;
+	SimTxBusy = 0;
+	SimTxFrameCount = 0;
+	SimTxErrors = 0;
+
+	SimPhyPartner = 0x05E1;	//All modes and pause.
+	SimPhyErrors = 0;
+	SimPhyResets = 0;
+	SimPhyCableIn = 1;
+	SimPhyLink = SimPhyLinkFailed = SimPhyAutoNego = 0;
+	SimPhyEventCount = 0;
+	SimPhyPowerOn();
+	SimPhyRestart();
+
+	SimRegAccesses = 0;
+	SimDmaBytes = 0;
+	SimRxOverreads = 0;
+}
+
+//Returns the position in the Rx FIFO that the read pointer register selects.
+static unsigned int SimRxFifoRdPtr(void){
+	return *(u16*)&SimSmapRegs[SMAP_R_RXFIFO_RD_PTR] % SMAP_RX_BUFSIZE;
+}
+
+static void SimRxFifoAdvance(unsigned int length){
+	//The FIFO is never filled up by the tests, so an equal read and write pointer means that it is empty.
+	if(length > (SimRxFifoWrPtr - SimRxFifoRdPtr()) % SMAP_RX_BUFSIZE)
+		SimRxOverreads++;
+	*(u16*)&SimSmapRegs[SMAP_R_RXFIFO_RD_PTR] = SMAP_RX_BASE + (SimRxFifoRdPtr() + length) % SMAP_RX_BUFSIZE;
+}
+
+//Applies the side effect of the last register write. The registers are accessed through pointers, so this is only known by the next access.
+void SimRegCommit(void){
+	volatile u8 *base;
+
+	if((base = SimPendingBase) == NULL)
+		return;
+	SimPendingBase = NULL;
+
+	switch(SimPendingOffset){
+		case SMAP_R_INTR_CLR:
+			SimIntrStat &= ~*(u16*)&base[SMAP_R_INTR_CLR];
+			*(u16*)&base[SMAP_R_INTR_CLR] = 0;
+			break;
+		case SMAP_R_TXFIFO_CTRL:
+			if(base[SMAP_R_TXFIFO_CTRL] & SMAP_TXFIFO_RESET)
+				SimTxFifoWrPtr = 0;
+			base[SMAP_R_TXFIFO_CTRL] &= ~(SMAP_TXFIFO_RESET | SMAP_TXFIFO_DMAEN);
+			break;
+		case SMAP_R_RXFIFO_CTRL:
+			if(base[SMAP_R_RXFIFO_CTRL] & SMAP_RXFIFO_RESET){
+				SimRxFifoWrPtr = 0;
+				*(u16*)&base[SMAP_R_RXFIFO_RD_PTR] = SMAP_RX_BASE;
+			}
+			base[SMAP_R_RXFIFO_CTRL] &= ~(SMAP_RXFIFO_RESET | SMAP_RXFIFO_DMAEN);
+			break;
+	}
+}
+
+static void SimRegCheck(unsigned int offset, unsigned int size){
+	if(offset + size > SIM_REGS_SIZE || (offset & (size - 1)) != 0){
+		fprintf(stderr, "sim: bad register access at 0x%x (%u bytes)\n", offset, size);
+		abort();
+	}
+}
+
+volatile void *SimRegister(volatile u8 *base, unsigned int offset, unsigned int size){
+	unsigned int i, count;
+	void *reg;
+
+	SimRegAccesses++;
+	SimRegCommit();
+	SimRegCheck(offset, size);
+
+	if(base == SimSmapRegs){
+		switch(offset){
+			case SMAP_R_TXFIFO_DATA:
+				reg = &SimTxFifo[SimTxFifoWrPtr];
+				SimTxFifoWrPtr = (SimTxFifoWrPtr + 4) % SMAP_TX_BUFSIZE;
+				return reg;
+			case SMAP_R_RXFIFO_DATA:
+				reg = &SimRxFifo[SimRxFifoRdPtr()];
+				SimRxFifoAdvance(4);
+				return reg;
+			case SMAP_R_RXFIFO_FRAME_CNT:
+				for(i = 0, count = 0; i < SMAP_BD_MAX_ENTRY; i++)
+					if(!(SimRxBD[i].ctrl_stat & SMAP_BD_RX_EMPTY)) count++;
+				SimSmapRegs[offset] = count;
+				break;
+			case SMAP_R_INTR_CLR:
+			case SMAP_R_TXFIFO_CTRL:
+			case SMAP_R_RXFIFO_CTRL:
+				SimPendingBase = base;
+				SimPendingOffset = offset;
+				break;
+		}
+	}
+	else if(base == SimSpdRegs && offset == SPD_R_INTR_STAT)
+		*(u16*)&SimSpdRegs[offset] = SimIntrStat;
+
+	return (volatile void*)&base[offset];
+}
+
+/* Interrupts */
+
+void SimIntrCheck(void){
+	unsigned int i;
+	u16 pending;
+
+	SimRegCommit();
+	if(SimIntrSuspended || SimIntrContext)
+		return;
+
+	while((pending = SimIntrStat & SimIntrMask) != 0){
+		for(i = 0; !(pending & (1 << i)); i++){};
+		if(SimIntrCb[i] == NULL){
+			fprintf(stderr, "sim: no handler for interrupt %u\n", i);
+			abort();
+		}
+
+		SimIntrContext = 1;
+		SimIntrCb[i](i);
+		SimIntrContext = 0;
+
+		if(SimIntrStat & SimIntrMask & (1 << i)){
+			fprintf(stderr, "sim: interrupt %u was not masked by its handler\n", i);
+			abort();
+		}
+	}
+
+	SimPreempt();
+}
+
+static void SimIntrRaise(u16 bits){
+	SimIntrStat |= bits;
+	SimIntrCheck();
+}
+
+/* EMAC3 */
+
+//Time taken to send a frame, in microseconds: with padding, FCS, preamble and the inter-frame gap.
+static u64 SimTxFrameTime(unsigned int length){
+	unsigned int speed;
+
+	if((speed = SimPhySpeed()) == 0) speed = 100;
+	if(length < 60) length = 60;
+	return ((length + 4 + 8 + 12) * 8 + speed - 1) / speed;
+}
+
+static void SimTxStart(void){
+	smap_bd_t *bd;
+
+	bd = &SimTxBD[SimTxBDIndex % SMAP_BD_MAX_ENTRY];
+	if(!SimTxBusy && (*(u32*)&SimEmac3Regs[SMAP_R_EMAC3_MODE0] & SMAP_E3_TXMAC_ENABLE) && (bd->ctrl_stat & SMAP_BD_TX_READY)){
+		SimTxBusy = 1;
+		SimTxDoneTime = SimTime + SimTxFrameTime(bd->length);
+	}
+}
+
+static void SimTxAdvance(void){
+	struct SimTxFrame *frame;
+	smap_bd_t *bd;
+	u16 status;
+
+	while(SimTxBusy && SimTxDoneTime <= SimTime){
+		bd = &SimTxBD[SimTxBDIndex % SMAP_BD_MAX_ENTRY];
+		status = SimTxErrors;
+		if(!SimPhyLink) status |= SMAP_BD_TX_LOSSCR;
+		if(SimTxFrameCount < SIM_MAX_TX_FRAMES){
+			frame = &SimTxFrames[SimTxFrameCount];
+			frame->time = SimTxDoneTime;
+			frame->status = status;
+			frame->length = bd->length;
+			SimTxFifoRead(bd->pointer, frame->data, bd->length <= sizeof(frame->data) ? bd->length : sizeof(frame->data));
+		}
+		SimTxFrameCount++;
+		bd->ctrl_stat = (bd->ctrl_stat & ~SMAP_BD_TX_READY) | status;
+		SimTxBDIndex++;
+		SimIntrStat |= SMAP_INTR_TXEND;
+
+		bd = &SimTxBD[SimTxBDIndex % SMAP_BD_MAX_ENTRY];
+		if(bd->ctrl_stat & SMAP_BD_TX_READY)
+			SimTxDoneTime += SimTxFrameTime(bd->length);
+		else{
+			SimTxBusy = 0;
+			SimIntrStat |= SMAP_INTR_TXDNV;
+		}
+	}
+}
+
+u32 SimEmac3Read(volatile u8 *base, unsigned int offset){
+	SimRegAccesses++;
+	SimRegCommit();
+	SimRegCheck(offset, 4);
+	(void)base;
+
+	return *(u32*)&SimEmac3Regs[offset];
+}
+
+void SimEmac3Write(volatile u8 *base, unsigned int offset, u32 value){
+	u32 *reg;
+
+	SimRegAccesses++;
+	SimRegCommit();
+	SimRegCheck(offset, 4);
+	(void)base;
+
+	reg = (u32*)&SimEmac3Regs[offset];
+	switch(offset){
+		case SMAP_R_EMAC3_MODE0:
+			if(value & SMAP_E3_SOFT_RESET){
+				memset(SimEmac3Regs, 0, sizeof(SimEmac3Regs));
+				SimTxBusy = 0;
+				SimTxBDIndex = 0;
+				value = 0;
+			}
+			*reg = value;
+			SimTxStart();
+			break;
+		case SMAP_R_EMAC3_TxMODE0:
+			*reg = value & ~SMAP_E3_TX_GNP_0;
+			if(value & SMAP_E3_TX_GNP_0)
+				SimTxStart();
+			break;
+		case SMAP_R_EMAC3_INTR_STAT:
+			*reg &= ~value;
+			break;
+		case SMAP_R_EMAC3_STA_CTRL:
+			//The PHY is accessed right away. Only the PHY at SMAP_DsPHYTER_ADDRESS is present.
+			if(((value >> SMAP_E3_PHY_ADDR_BITSFT) & SMAP_E3_PHY_ADDR_MSK) != SMAP_DsPHYTER_ADDRESS)
+				*reg = (value & 0xFFFF) | 0xFFFF0000 | SMAP_E3_PHY_OP_COMP;
+			else if(value & SMAP_E3_PHY_READ)
+				*reg = (value & 0xFFFF) | (u32)SimPhyRead(value & SMAP_E3_PHY_REG_ADDR_MSK) << SMAP_E3_PHY_DATA_BITSFT | SMAP_E3_PHY_OP_COMP;
+			else if(value & SMAP_E3_PHY_WRITE){
+				SimPhyWrite(value & SMAP_E3_PHY_REG_ADDR_MSK, value >> SMAP_E3_PHY_DATA_BITSFT);
+				*reg = value | SMAP_E3_PHY_OP_COMP;
+			}
+			break;
+		default:
+			*reg = value;
+	}
+}
+
+void SimEmac3PauseFrame(void){
+	*(u32*)&SimEmac3Regs[SMAP_R_EMAC3_INTR_STAT] |= SMAP_E3_INTR_PF;
+	SimIntrRaise(SMAP_INTR_EMAC3);
+}
+
+u64 SimHwNextEvent(void){
+	u64 next;
+
+	next = SimTxBusy ? SimTxDoneTime : 0;
+	if(SimPhyEventCount > 0 && (next == 0 || SimPhyEvents[0].time < next))
+		next = SimPhyEvents[0].time;
+	if(SimPhyLinkTime != 0 && (next == 0 || SimPhyLinkTime < next))
+		next = SimPhyLinkTime;
+
+	return next;
+}
+
+void SimHwAdvance(void){
+	SimPhyAdvance();
+	SimTxAdvance();
+	SimIntrCheck();
+}
+
+/* FIFOs */
+
+u16 SimRxFrame(const u8 *frame, unsigned int length, u16 errors){
+	unsigned int i, pointer;
+	smap_bd_t *bd;
+
+	bd = &SimRxBD[SimRxBDIndex % SMAP_BD_MAX_ENTRY];
+	if(!(bd->ctrl_stat & SMAP_BD_RX_EMPTY)){
+		//No Rx BD is available, so the frame is lost.
+		SimIntrRaise(SMAP_INTR_RXDNV);
+		return 0;
+	}
+
+	pointer = SimRxFifoWrPtr;
+	for(i = 0; i < length; i++)
+		SimRxFifo[(pointer + i) % SMAP_RX_BUFSIZE] = frame[i];
+	SimRxFifoWrPtr = (pointer + ((length + 3) & ~3)) % SMAP_RX_BUFSIZE;
+
+	SimRxBDIndex++;
+	bd->length = length;
+	bd->pointer = SMAP_RX_BASE + pointer;
+	bd->ctrl_stat = errors;
+
+	SimIntrRaise(SMAP_INTR_RXEND);
+
+	return bd->pointer;
+}
+
+void SimRxSkip(unsigned int length){
+	SimRxFifoWrPtr = (SimRxFifoWrPtr + length) % SMAP_RX_BUFSIZE;
+}
+
+void SimTxFifoRead(u16 pointer, u8 *buffer, unsigned int length){
+	unsigned int i;
+
+	for(i = 0; i < length; i++)
+		buffer[i] = SimTxFifo[(pointer - SMAP_TX_BASE + i) % SMAP_TX_BUFSIZE];
+}
+
+/* DEV9 */
+
+int dev9DmaTransfer(int ctrl, void *buf, int bcr, int dir){
+	unsigned int i, length;
+	u8 *data;
+
+	(void)ctrl;
+
+	if(SimPreDmaCb != NULL)
+		SimPreDmaCb(bcr, dir);
+
+	data = buf;
+	length = ((u32)bcr >> 16) * (bcr & 0xFFFF) * 4;
+	if(dir == DMAC_TO_MEM){
+		for(i = 0; i < length; i++)
+			data[i] = SimRxFifo[(SimRxFifoRdPtr() + i) % SMAP_RX_BUFSIZE];
+		SimRxFifoAdvance(length);
+	}
+	else{
+		for(i = 0; i < length; i++)
+			SimTxFifo[(SimTxFifoWrPtr + i) % SMAP_TX_BUFSIZE] = data[i];
+		SimTxFifoWrPtr = (SimTxFifoWrPtr + length) % SMAP_TX_BUFSIZE;
+	}
+	SimDmaBytes += length;
+
+	if(SimPostDmaCb != NULL)
+		SimPostDmaCb(bcr, dir);
+
+	return 0;
+}
+
+void dev9RegisterIntrCb(int intr, dev9_intr_cb_t cb){
+	SimIntrCb[intr] = cb;
+}
+
+void dev9RegisterPreDmaCb(int ctrl, dev9_dma_cb_t cb){
+	(void)ctrl;
+	SimPreDmaCb = cb;
+}
+
+void dev9RegisterPostDmaCb(int ctrl, dev9_dma_cb_t cb){
+	(void)ctrl;
+	SimPostDmaCb = cb;
+}
+
+void dev9IntrEnable(int mask){
+	SimIntrMask |= mask;
+	SimIntrCheck();
+}
+
+void dev9IntrDisable(int mask){
+	SimIntrMask &= ~mask;
+}
+
+int dev9GetEEPROM(u16 *buf){
+	unsigned int i;
+
+	for(i = 0; i < 3; i++)
+		buf[i] = SimMacAddress[i * 2] | SimMacAddress[i * 2 + 1] << 8;
+	buf[3] = buf[0] + buf[1] + buf[2];
+
+	return 0;
+}
+
+/* pbufs */
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, u16 length, pbuf_type type){
+	struct pbuf *head, *tail, *p;
+	unsigned int remaining, size;
+
+	(void)layer;
+
+	head = tail = NULL;
+	remaining = length;
+	do{
+		size = (type == PBUF_POOL && remaining > SimPbufPoolBufSize) ? SimPbufPoolBufSize : remaining;
+		if((p = malloc(sizeof(struct pbuf) + 4 + size + SIM_PBUF_SLACK)) == NULL){
+			if(head != NULL) pbuf_free(head);
+			return NULL;
+		}
+		p->next = NULL;
+		p->payload = (u8*)(((size_t)(p + 1) + 3) & ~(size_t)3);
+		p->tot_len = remaining;
+		p->len = size;
+		p->type = type;
+		p->flags = 0;
+		p->ref = 1;
+		SimPbufsInUse++;
+
+		if(tail != NULL) tail->next = p;
+		else head = p;
+		tail = p;
+		remaining -= size;
+	}while(remaining > 0);
+
+	return head;
+}
+
+//Only shrinking a single pbuf is supported, which is all that the driver does.
+void pbuf_realloc(struct pbuf *p, u16 size){
+	if(p->next != NULL || size > p->len){
+		fprintf(stderr, "sim: unsupported pbuf_realloc(%u) of a %u byte pbuf\n", size, p->len);
+		abort();
+	}
+	p->len = p->tot_len = size;
+}
+
+u8 pbuf_free(struct pbuf *p){
+	struct pbuf *next;
+	u8 count;
+
+	for(count = 0; p != NULL && --p->ref == 0; p = next, count++){
+		next = p->next;
+		free(p);
+		SimPbufsInUse--;
+	}
+
+	return count;
+}
+
+void pbuf_ref(struct pbuf *p){
+	p->ref++;
+}
+
+struct pbuf *SimPbufRef(const u8 *data, unsigned int length, unsigned int offset){
+	struct pbuf *p;
+
+	if((p = malloc(sizeof(struct pbuf) + 8 + length + SIM_PBUF_SLACK)) == NULL)
+		abort();
+	p->next = NULL;
+	p->payload = (u8*)(((size_t)(p + 1) + 3) & ~(size_t)3) + offset;
+	memcpy(p->payload, data, length);
+	memset((u8*)p->payload + length, 0xEE, SIM_PBUF_SLACK);
+	p->tot_len = length;
+	p->len = length;
+	p->type = PBUF_REF;
+	p->flags = 0;
+	p->ref = 1;
+	SimPbufsInUse++;
+
+	return p;
+}
@@ -0,0 +1,125 @@
+/*	Model of the SMAP hardware and of the IOP kernel and ps2ip services that the driver uses, for running the driver on the host.	*/
+
+#ifndef SIM_H
+#define SIM_H
+
+#include <tamtypes.h>
+#include <ps2ip.h>
+
+#define SIM_MAX_FRAMES		64
+#define SIM_MAX_TX_FRAMES	4096
+
+/* Hardware (sim.c) */
+
+//Register blocks, for smap_regbase and emac3_regbase of struct SmapDriverData.
+extern u8 SimSmapRegs[], SimEmac3Regs[], SimSpdRegs[];
+
+//MAC address held by the EEPROM.
+extern const u8 SimMacAddress[6];
+
+//Register accesses across the DEV9 bus (BD accesses are not counted), and bytes moved by DMA.
+extern unsigned int SimRegAccesses, SimDmaBytes;
+
+//Reads of the Rx FIFO past the last word stored by the EMAC3.
+extern unsigned int SimRxOverreads;
+
+//Largest PBUF_POOL buffer. Longer pbufs are chained, like with PBUF_POOL_BUFSIZE of lwIP.
+extern unsigned int SimPbufPoolBufSize;
+
+//Number of pbufs allocated and not yet freed.
+extern int SimPbufsInUse;
+
+//Frames handed over to the stack with ethernet_input().
+extern struct pbuf *SimRxDelivered[SIM_MAX_FRAMES];
+extern unsigned int SimRxDeliveredCount;
+
+//Frames sent by the EMAC3, in order. Only the first SIM_MAX_TX_FRAMES are kept, but all are counted.
+struct SimTxFrame{
+	u64 time;		//When the frame was sent, in microseconds.
+	u16 status;		//Status bits written back into the Tx BD.
+	u16 length;
+	u8 data[1516];
+};
+
+extern struct SimTxFrame SimTxFrames[SIM_MAX_TX_FRAMES];
+extern unsigned int SimTxFrameCount;
+
+//Status bits to write back into the Tx BDs of the frames sent from now on, in addition to SMAP_BD_TX_LOSSCR while there is no link.
+extern u16 SimTxErrors;
+
+/*	PHY (DP83846A) and link partner. The partner advertises SimPhyPartner (in the format of ANLPAR), and auto-negotiation takes
+	SIM_PHY_AUTONEGO_TIME. Without auto-negotiation, the link comes up SIM_PHY_LINK_TIME after the PHY is configured.	*/
+#define SIM_PHY_AUTONEGO_TIME	1500000
+#define SIM_PHY_LINK_TIME	50000
+
+extern u16 SimPhyPartner;
+//Receive errors reported by RECR, while the link was established by auto-negotiation.
+extern u16 SimPhyErrors;
+//Number of PHY resets through BMCR.
+extern unsigned int SimPhyResets;
+
+//Connects or disconnects the cable, after delay microseconds.
+void SimPhyCable(int connected, unsigned int delay);
+//Puts the PHY into the state that it is left in by a driver that has established a link through auto-negotiation, for -warm.
+void SimPhyLinked(void);
+//Returns the speed of the link in Mbit/s, or 0 if there is no link.
+unsigned int SimPhySpeed(void);
+
+//Resets the model: FIFOs, BDs, registers, interrupts, the PHY, the counters above and the frames delivered (which are freed).
+void SimReset(void);
+
+//Stores a frame into the Rx FIFO like the EMAC3 would, with the given error bits in its BD, and raises RXEND. Returns the BD pointer of the frame.
+u16 SimRxFrame(const u8 *frame, unsigned int length, u16 errors);
+
+//Leaves a gap of length bytes (a multiple of 4) before the next frame stored into the Rx FIFO, as if the EMAC3 had abandoned a frame.
+void SimRxSkip(unsigned int length);
+
+//Copies length bytes of the Tx FIFO, starting at the BD pointer of a frame.
+void SimTxFifoRead(u16 pointer, u8 *buffer, unsigned int length);
+
+//Latches the reception of a pause frame in the EMAC3, which raises the EMAC3 interrupt.
+void SimEmac3PauseFrame(void);
+
+//Allocates a pbuf whose payload starts offset bytes past a word boundary, and holds a copy of data.
+struct pbuf *SimPbufRef(const u8 *data, unsigned int length, unsigned int offset);
+
+/* Kernel and ps2ip (simos.c) */
+
+/*	Threads are scheduled by priority, without time slicing, like on the IOP. The test runs in the main thread, which stands in for the tcpip-thread
+	and has a lower priority than the driver's thread. Time only passes while every thread is waiting, and is advanced to the next event.
+	The system clock counts in microseconds, and starts shortly before its low word wraps around.	*/
+#define SIM_MAIN_PRIORITY	0x40
+#define SIM_TIME_START		0xFFC00000ULL
+
+extern u64 SimTime;
+
+//Resets the kernel: threads other than the main thread, event flags, alarms, the tcpip-thread's mailbox and the time.
+void SimKernelReset(void);
+
+//Lets time pass for usec microseconds, while running the callbacks sent to the tcpip-thread.
+void SimRun(unsigned int usec);
+
+//Runs the callbacks sent to the tcpip-thread so far.
+void SimTcpipRun(void);
+
+//The netif added by the driver, and the number of times that its link went up and down.
+extern struct netif *SimNetif;
+extern unsigned int SimLinkUpCount, SimLinkDownCount;
+
+/* Between the models */
+
+//Interrupts are suspended with CpuSuspendIntr(), or an interrupt handler or alarm handler is running.
+extern int SimIntrSuspended, SimIntrContext;
+
+//Returns the time of the next hardware event, or 0 if there is none.
+u64 SimHwNextEvent(void);
+//Handles the hardware events that are due, as time passes.
+void SimHwAdvance(void);
+//Applies the side effect of the last register written.
+void SimRegCommit(void);
+//Delivers the pending interrupts that are enabled, unless they are suspended.
+void SimIntrCheck(void);
+//Switches to a thread of a higher priority than the current one, if one is ready.
+void SimPreempt(void);
+
+#endif
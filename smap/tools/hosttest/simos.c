@@ -0,0 +1,561 @@
+/*	Model of the IOP kernel and of the ps2ip services that the driver uses, for running the driver on the host. The hardware is modelled in sim.c.
+
+	Modelled:
+		- threads, scheduled by priority without time slicing. A thread runs until it waits, or until a thread of a higher priority becomes ready.
+		  Each thread runs on a stack of its own, switched to with swapcontext().
+		- event flags, DelayThread(), and alarms, whose handlers run like interrupt handlers.
+		- the system clock, which only advances while every thread is waiting: straight to the next alarm, wakeup or hardware event.
+		- the library of the module, which can only be registered once.
+		- the tcpip-thread's mailbox. The callbacks sent to the tcpip-thread are run by the main thread, from SimRun() and SimTcpipRun().
+		- the netif functions. Frames passed to ethernet_input() are kept in SimRxDelivered.	*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+#include <intrman.h>
+#include <loadcore.h>
+#include <thbase.h>
+#include <thevent.h>
+#include <ps2ip.h>
+
+#include "sim.h"
+
+#define SIM_MAX_THREADS		4
+#define SIM_STACK_SIZE		(256 * 1024)	//Host code needs more stack than the IOP, for printf() and the like.
+#define SIM_MAX_EVENT_FLAGS	4
+#define SIM_MAX_ALARMS		8
+#define SIM_TCPIP_MBOX_SIZE	32
+
+#define SIM_ERR_MEM		-1
+#define SIM_KE_EVF_COND		-421
+#define SIM_KE_NOTFOUND_ALARM	-150
+
+enum SIM_THREAD_STATE{
+	SIM_THREAD_NONE = 0,
+	SIM_THREAD_DORMANT,
+	SIM_THREAD_READY,	//Including the thread that is running.
+	SIM_THREAD_SLEEP,
+	SIM_THREAD_WAIT_EVENT
+};
+
+struct SimThread{
+	ucontext_t context;
+	int state;
+	unsigned int priority;
+	void (*entry)(void *arg);
+	void *arg;
+	void *stack;
+	u64 wakeup;		//SIM_THREAD_SLEEP
+	int ef;			//SIM_THREAD_WAIT_EVENT
+	u32 bits;
+	int mode;
+	u32 *result;
+};
+
+struct SimAlarm{
+	unsigned int (*handler)(void *arg);
+	void *arg;
+	u64 due;
+};
+
+struct SimEventFlag{
+	int used;
+	u32 bits;
+};
+
+u64 SimTime = SIM_TIME_START;
+int SimIntrSuspended, SimIntrContext;
+struct netif *SimNetif;
+unsigned int SimLinkUpCount, SimLinkDownCount;
+
+static struct SimThread SimThreads[SIM_MAX_THREADS] = {{.state = SIM_THREAD_READY, .priority = SIM_MAIN_PRIORITY}};
+static int SimCurrent;		//Index of the running thread. The main thread is 0.
+static int SimAdvancing;	//Time is being advanced, so threads are not switched until the next one is picked.
+static struct SimEventFlag SimEventFlags[SIM_MAX_EVENT_FLAGS];
+static struct SimAlarm SimAlarms[SIM_MAX_ALARMS];
+static unsigned int SimAlarmCount;
+static int SimLibraryRegistered;
+
+static struct{
+	tcpip_callback_fn function;
+	void *ctx;
+} SimTcpipMbox[SIM_TCPIP_MBOX_SIZE];
+static unsigned int SimTcpipMboxHead, SimTcpipMboxTail;
+
+void SimKernelReset(void){
+	int i;
+
+	if(SimCurrent != 0){
+		fprintf(stderr, "sim: the kernel can only be reset from the main thread\n");
+		abort();
+	}
+
+	for(i = 1; i < SIM_MAX_THREADS; i++){
+		free(SimThreads[i].stack);
+		memset(&SimThreads[i], 0, sizeof(SimThreads[i]));
+	}
+	memset(SimEventFlags, 0, sizeof(SimEventFlags));
+	SimAlarmCount = 0;
+	SimTcpipMboxHead = SimTcpipMboxTail = 0;
+	SimLibraryRegistered = 0;
+	SimIntrSuspended = SimIntrContext = 0;
+	SimNetif = NULL;
+	SimLinkUpCount = SimLinkDownCount = 0;
+	SimTime = SIM_TIME_START;
+}
+
+/* Scheduler */
+
+//Advances the time to the next event and handles every event that is due, unless a thread is to be woken up right away.
+static void SimAdvance(void){
+	u64 next, hw;
+	unsigned int i, first;
+	int t;
+
+	next = 0;
+	for(t = 0; t < SIM_MAX_THREADS; t++){
+		if(SimThreads[t].state == SIM_THREAD_SLEEP && (next == 0 || SimThreads[t].wakeup < next))
+			next = SimThreads[t].wakeup;
+	}
+	for(i = 0; i < SimAlarmCount; i++){
+		if(next == 0 || SimAlarms[i].due < next)
+			next = SimAlarms[i].due;
+	}
+	if((hw = SimHwNextEvent()) != 0 && (next == 0 || hw < next))
+		next = hw;
+
+	if(next == 0){
+		fprintf(stderr, "sim: every thread is waiting for an event that will not happen\n");
+		abort();
+	}
+	if(next > SimTime)
+		SimTime = next;
+
+	SimAdvancing = 1;
+
+	SimHwAdvance();
+
+	//Alarm handlers run like interrupt handlers. A handler that returns a non-zero interval is rescheduled.
+	while(SimAlarmCount > 0){
+		for(i = 1, first = 0; i < SimAlarmCount; i++){
+			if(SimAlarms[i].due < SimAlarms[first].due)
+				first = i;
+		}
+		if(SimAlarms[first].due > SimTime)
+			break;
+
+		SimIntrContext = 1;
+		next = SimAlarms[first].handler(SimAlarms[first].arg);
+		SimIntrContext = 0;
+		if(next != 0)
+			SimAlarms[first].due += next;
+		else
+			SimAlarms[first] = SimAlarms[--SimAlarmCount];
+	}
+
+	for(t = 0; t < SIM_MAX_THREADS; t++){
+		if(SimThreads[t].state == SIM_THREAD_SLEEP && SimThreads[t].wakeup <= SimTime)
+			SimThreads[t].state = SIM_THREAD_READY;
+	}
+
+	SimAdvancing = 0;
+}
+
+//Switches to the ready thread of the highest priority, letting time pass until one is ready. The current thread keeps running among equals.
+static void SimSchedule(void){
+	int next, t, previous;
+
+	SimRegCommit();
+	while(1){
+		next = (SimThreads[SimCurrent].state == SIM_THREAD_READY) ? SimCurrent : -1;
+		for(t = 0; t < SIM_MAX_THREADS; t++){
+			if(SimThreads[t].state == SIM_THREAD_READY && (next < 0 || SimThreads[t].priority < SimThreads[next].priority))
+				next = t;
+		}
+		if(next >= 0) break;
+
+		SimAdvance();
+	}
+
+	if(next != SimCurrent){
+		previous = SimCurrent;
+		SimCurrent = next;
+		swapcontext(&SimThreads[previous].context, &SimThreads[next].context);
+	}
+}
+
+void SimPreempt(void){
+	int t;
+
+	if(SimAdvancing || SimIntrContext)
+		return;
+
+	for(t = 0; t < SIM_MAX_THREADS; t++){
+		if(SimThreads[t].state == SIM_THREAD_READY && SimThreads[t].priority < SimThreads[SimCurrent].priority){
+			SimSchedule();
+			return;
+		}
+	}
+}
+
+static void SimThreadEntry(void){
+	struct SimThread *thread;
+
+	thread = &SimThreads[SimCurrent];
+	thread->entry(thread->arg);
+
+	thread->state = SIM_THREAD_DORMANT;
+	SimSchedule();
+}
+
+/* Threads */
+
+int CreateThread(iop_thread_t *thread){
+	int t;
+
+	for(t = 1; t < SIM_MAX_THREADS; t++){
+		if(SimThreads[t].state == SIM_THREAD_NONE){
+			memset(&SimThreads[t], 0, sizeof(SimThreads[t]));
+			if((SimThreads[t].stack = malloc(SIM_STACK_SIZE)) == NULL)
+				return -400;	//KE_NO_MEMORY
+			SimThreads[t].state = SIM_THREAD_DORMANT;
+			SimThreads[t].priority = thread->priority;
+			SimThreads[t].entry = thread->thread;
+			return t;
+		}
+	}
+
+	return -400;
+}
+
+int DeleteThread(int thid){
+	if(thid <= 0 || thid >= SIM_MAX_THREADS || SimThreads[thid].state != SIM_THREAD_DORMANT)
+		return -407;	//KE_UNKNOWN_THID
+
+	free(SimThreads[thid].stack);
+	memset(&SimThreads[thid], 0, sizeof(SimThreads[thid]));
+	return 0;
+}
+
+int StartThread(int thid, void *arg){
+	struct SimThread *thread;
+
+	if(thid <= 0 || thid >= SIM_MAX_THREADS || SimThreads[thid].state != SIM_THREAD_DORMANT)
+		return -407;
+
+	thread = &SimThreads[thid];
+	thread->arg = arg;
+	getcontext(&thread->context);
+	thread->context.uc_stack.ss_sp = thread->stack;
+	thread->context.uc_stack.ss_size = SIM_STACK_SIZE;
+	thread->context.uc_link = NULL;
+	makecontext(&thread->context, &SimThreadEntry, 0);
+	thread->state = SIM_THREAD_READY;
+
+	SimPreempt();
+	return 0;
+}
+
+int DelayThread(int usec){
+	SimThreads[SimCurrent].state = SIM_THREAD_SLEEP;
+	SimThreads[SimCurrent].wakeup = SimTime + usec;
+	SimSchedule();
+	return 0;
+}
+
+int GetThreadId(void){
+	return SimCurrent;
+}
+
+/* Event flags */
+
+static int SimEventFlagMatch(struct SimEventFlag *flag, u32 bits, int mode, u32 *result){
+	if((mode & WEF_OR) ? (flag->bits & bits) == 0 : (flag->bits & bits) != bits)
+		return 0;
+
+	if(result != NULL)
+		*result = flag->bits;
+	if(mode & WEF_CLEAR)
+		flag->bits &= ~bits;
+
+	return 1;
+}
+
+static struct SimEventFlag *SimEventFlagGet(int ef){
+	if(ef <= 0 || ef > SIM_MAX_EVENT_FLAGS || !SimEventFlags[ef - 1].used){
+		fprintf(stderr, "sim: unknown event flag %d\n", ef);
+		abort();
+	}
+
+	return &SimEventFlags[ef - 1];
+}
+
+int CreateEventFlag(iop_event_t *event){
+	int ef;
+
+	for(ef = 0; ef < SIM_MAX_EVENT_FLAGS; ef++){
+		if(!SimEventFlags[ef].used){
+			SimEventFlags[ef].used = 1;
+			SimEventFlags[ef].bits = event->bits;
+			return ef + 1;
+		}
+	}
+
+	return -400;
+}
+
+int DeleteEventFlag(int ef){
+	SimEventFlagGet(ef)->used = 0;
+	return 0;
+}
+
+int iSetEventFlag(int ef, u32 bits){
+	struct SimEventFlag *flag;
+	struct SimThread *thread;
+	int t;
+
+	flag = SimEventFlagGet(ef);
+	flag->bits |= bits;
+	for(t = 0; t < SIM_MAX_THREADS; t++){
+		thread = &SimThreads[t];
+		if(thread->state == SIM_THREAD_WAIT_EVENT && thread->ef == ef && SimEventFlagMatch(flag, thread->bits, thread->mode, thread->result))
+			thread->state = SIM_THREAD_READY;
+	}
+
+	return 0;
+}
+
+int SetEventFlag(int ef, u32 bits){
+	iSetEventFlag(ef, bits);
+	SimPreempt();
+	return 0;
+}
+
+int ClearEventFlag(int ef, u32 bits){
+	SimEventFlagGet(ef)->bits &= bits;
+	return 0;
+}
+
+int WaitEventFlag(int ef, u32 bits, int mode, u32 *result){
+	struct SimThread *thread;
+
+	if(SimEventFlagMatch(SimEventFlagGet(ef), bits, mode, result))
+		return 0;
+
+	//The thread that sets the flag stores the result and makes this thread ready.
+	thread = &SimThreads[SimCurrent];
+	thread->state = SIM_THREAD_WAIT_EVENT;
+	thread->ef = ef;
+	thread->bits = bits;
+	thread->mode = mode;
+	thread->result = result;
+	SimSchedule();
+
+	return 0;
+}
+
+int PollEventFlag(int ef, u32 bits, int mode, u32 *result){
+	return SimEventFlagMatch(SimEventFlagGet(ef), bits, mode, result) ? 0 : SIM_KE_EVF_COND;
+}
+
+/* Alarms and the system clock */
+
+int SetAlarm(iop_sys_clock_t *clock, unsigned int (*handler)(void *arg), void *arg){
+	if(SimAlarmCount >= SIM_MAX_ALARMS)
+		return -400;
+
+	SimAlarms[SimAlarmCount].handler = handler;
+	SimAlarms[SimAlarmCount].arg = arg;
+	SimAlarms[SimAlarmCount].due = SimTime + ((u64)clock->hi << 32 | clock->lo);
+	SimAlarmCount++;
+
+	return 0;
+}
+
+int CancelAlarm(unsigned int (*handler)(void *arg), void *arg){
+	unsigned int i;
+
+	for(i = 0; i < SimAlarmCount; i++){
+		if(SimAlarms[i].handler == handler && SimAlarms[i].arg == arg){
+			SimAlarms[i] = SimAlarms[--SimAlarmCount];
+			return 0;
+		}
+	}
+
+	return SIM_KE_NOTFOUND_ALARM;
+}
+
+//The system clock counts in microseconds.
+void GetSystemTime(iop_sys_clock_t *clock){
+	clock->lo = (u32)SimTime;
+	clock->hi = (u32)(SimTime >> 32);
+}
+
+void USec2SysClock(u32 usec, iop_sys_clock_t *clock){
+	clock->lo = usec;
+	clock->hi = 0;
+}
+
+void SysClock2USec(iop_sys_clock_t *clock, u32 *sec, u32 *usec){
+	u64 ticks;
+
+	ticks = (u64)clock->hi << 32 | clock->lo;
+	*sec = ticks / 1000000;
+	*usec = ticks % 1000000;
+}
+
+/* Interrupts */
+
+int CpuSuspendIntr(int *state){
+	*state = SimIntrSuspended;
+	SimIntrSuspended = 1;
+	return 0;
+}
+
+int CpuResumeIntr(int state){
+	SimIntrSuspended = state;
+	if(!state)
+		SimIntrCheck();
+	return 0;
+}
+
+/* Modules */
+
+int RegisterLibraryEntries(struct irx_export_table *exports){
+	(void)exports;
+
+	if(SimLibraryRegistered)
+		return -1;
+	SimLibraryRegistered = 1;
+	return 0;
+}
+
+int ReleaseLibraryEntries(struct irx_export_table *exports){
+	(void)exports;
+
+	SimLibraryRegistered = 0;
+	return 0;
+}
+
+struct irx_export_table _exp_smap;
+
+/* tcpip-thread */
+
+err_t tcpip_callback_with_block(tcpip_callback_fn function, void *ctx, u8 block){
+	while(SimTcpipMboxHead - SimTcpipMboxTail >= SIM_TCPIP_MBOX_SIZE){
+		if(!block)
+			return SIM_ERR_MEM;
+
+		//Wait for the tcpip-thread to make room, unless this is the tcpip-thread.
+		if(SimCurrent == 0)
+			SimTcpipRun();
+		else
+			DelayThread(1000);
+	}
+
+	SimTcpipMbox[SimTcpipMboxHead % SIM_TCPIP_MBOX_SIZE].function = function;
+	SimTcpipMbox[SimTcpipMboxHead % SIM_TCPIP_MBOX_SIZE].ctx = ctx;
+	SimTcpipMboxHead++;
+
+	return 0;
+}
+
+void SimTcpipRun(void){
+	unsigned int tail;
+
+	while(SimTcpipMboxTail != SimTcpipMboxHead){
+		tail = SimTcpipMboxTail++ % SIM_TCPIP_MBOX_SIZE;
+		SimTcpipMbox[tail].function(SimTcpipMbox[tail].ctx);
+	}
+}
+
+void SimRun(unsigned int usec){
+	u64 end;
+
+	if(SimCurrent != 0){
+		fprintf(stderr, "sim: SimRun() must be called from the main thread\n");
+		abort();
+	}
+
+	end = SimTime + usec;
+	do{
+		SimTcpipRun();
+		DelayThread((end - SimTime) < 1000 ? (end - SimTime) : 1000);
+	}while(SimTime < end);
+	SimTcpipRun();
+}
+
+err_t tcpip_input(struct pbuf *p, struct netif *inp){
+	return ethernet_input(p, inp);
+}
+
+/* netif */
+
+struct netif *netif_add(struct netif *netif, const ip4_addr_t *ipaddr, const ip4_addr_t *netmask, const ip4_addr_t *gw, void *state, netif_init_fn init, netif_input_fn input){
+	memset(netif, 0, sizeof(*netif));
+	netif->ip_addr = *ipaddr;
+	netif->netmask = *netmask;
+	netif->gw = *gw;
+	netif->state = state;
+	netif->input = input;
+	netif->chksum_flags = NETIF_CHECKSUM_ENABLE_ALL;
+
+	if(init(netif) != 0)
+		return NULL;
+
+	SimNetif = netif;
+	return netif;
+}
+
+void netif_set_default(struct netif *netif){
+	(void)netif;
+}
+
+void netif_set_up(struct netif *netif){
+	netif->flags |= NETIF_FLAG_UP;
+}
+
+void netif_set_link_up(struct netif *netif){
+	if(!(netif->flags & NETIF_FLAG_LINK_UP)){
+		netif->flags |= NETIF_FLAG_LINK_UP;
+		SimLinkUpCount++;
+	}
+}
+
+void netif_set_link_down(struct netif *netif){
+	if(netif->flags & NETIF_FLAG_LINK_UP){
+		netif->flags &= ~NETIF_FLAG_LINK_UP;
+		SimLinkDownCount++;
+	}
+}
+
+err_t etharp_output(struct netif *netif, struct pbuf *q, const ip4_addr_t *ipaddr){
+	(void)netif;
+	(void)q;
+	(void)ipaddr;
+
+	fprintf(stderr, "sim: etharp_output() is not modelled\n");
+	abort();
+}
+
+err_t ethernet_input(struct pbuf *p, struct netif *netif){
+	(void)netif;
+
+	if(SimRxDeliveredCount < SIM_MAX_FRAMES)
+		SimRxDelivered[SimRxDeliveredCount++] = p;
+	else
+		pbuf_free(p);
+
+	return 0;
+}
+
+u32 inet_addr(const char *cp){
+	unsigned int a, b, c, d;
+
+	if(sscanf(cp, "%u.%u.%u.%u", &a, &b, &c, &d) != 4)
+		return 0xFFFFFFFF;
+
+	return a | b << 8 | c << 16 | d << 24;
+}
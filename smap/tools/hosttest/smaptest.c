@@ -0,0 +1,734 @@
+/*	Tests of the SMAP driver, run on the host against the models in sim.c and simos.c.
+	Build and run with "make test" in this directory. Run "./smaptest -v [test...]" to see the messages of the driver, or to run only some tests.
+	The tests in this file call the FIFO and buffer functions directly. Those in drivertest.c load the whole driver.	*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <tamtypes.h>
+#include <thbase.h>
+#include <ps2ip.h>
+#include <smapregs.h>
+
+#include "main.h"
+#include "xfer.h"
+
+#include "sim.h"
+#include "test.h"
+
+extern struct SmapDriverData SmapDriverData;
+
+unsigned int failures;
+static int verbose;
+
+static u32 seed = 1;
+
+u32 Random(void){
+	seed ^= seed << 13;
+	seed ^= seed >> 17;
+	seed ^= seed << 5;
+	return seed;
+}
+
+static void SetUp(void){
+	SMapRxRingFlush(&SmapDriverData);
+	SimReset();
+	memset(&SmapDriverData, 0, sizeof(SmapDriverData));
+	SmapDriverData.smap_regbase = SimSmapRegs;
+	SmapDriverData.emac3_regbase = SimEmac3Regs;
+	SmapDriverData.DmaSliceShift = 6;
+	SmapDriverData.DmaMin = 64;
+	SmapDriverData.TxBufferSpaceAvailable = SMAP_TX_BUFSIZE;
+}
+
+//Services the Rx FIFO like the interrupt handler thread does, and lets the tcpip-thread pass the frames on.
+static void Receive(void){
+	HandleRxIntr(&SmapDriverData, 0);
+	SimTcpipRun();
+}
+
+/* Rx checksum verification (-rxcsum) */
+
+//RFC 1071 checksum over bytes, in network byte order.
+static u16 RefChecksum(const u8 *data, unsigned int length, u32 sum){
+	unsigned int i;
+
+	for(i = 0; i + 1 < length; i += 2)
+		sum += data[i] << 8 | data[i + 1];
+	if(i < length)
+		sum += data[i] << 8;
+	while(sum >> 16)
+		sum = (sum & 0xFFFF) + (sum >> 16);
+
+	return ~sum & 0xFFFF;
+}
+
+enum CSUM_CASE{
+	CSUM_TCP_OK = 0,
+	CSUM_TCP_BAD_DATA,
+	CSUM_TCP_BAD_HEADER,
+	CSUM_TCP_FRAGMENT,
+	CSUM_TCP_PADDED,	//Ethernet padding after the datagram.
+	CSUM_IP_BAD_IHL,
+	CSUM_IP_TRUNCATED,	//Total length runs past the end of the frame.
+	CSUM_UDP_BAD,		//Left to the stack.
+	CSUM_NOT_IP,
+
+	CSUM_CASES
+};
+
+//Builds a frame of the given case into frame. Returns its length, and whether the driver has to pass it on.
+static unsigned int BuildCsumFrame(u8 *frame, enum CSUM_CASE type, int *pass){
+	unsigned int i, length, IPHeaderLength, TotalLength, PayloadLength;
+	u8 pseudo[12];
+	u16 sum;
+
+	PayloadLength = (type == CSUM_TCP_PADDED) ? 0 : Random() % 1460;
+	IPHeaderLength = 20 + (Random() % 11) * 4;
+	TotalLength = IPHeaderLength + 20 + PayloadLength;
+	if(TotalLength > 1500){
+		PayloadLength -= TotalLength - 1500;
+		TotalLength = 1500;
+	}
+	length = 14 + TotalLength;
+
+	for(i = 0; i < length; i++)
+		frame[i] = Random();
+	frame[12] = 0x08;
+	frame[13] = 0x00;
+	frame[14] = 0x40 | IPHeaderLength / 4;
+	frame[14 + 2] = TotalLength >> 8;
+	frame[14 + 3] = TotalLength;
+	frame[14 + 6] = 0x40;	//DF
+	frame[14 + 7] = 0;
+	frame[14 + 9] = (type == CSUM_UDP_BAD) ? 17 : 6;
+	if(type == CSUM_TCP_FRAGMENT)
+		frame[14 + 6] = 0x20 | (Random() & 1);	//MF, with or without an offset.
+	if(type == CSUM_IP_BAD_IHL)
+		frame[14] = 0x40 | (Random() % 5);
+
+	frame[14 + 10] = frame[14 + 11] = 0;
+	sum = RefChecksum(&frame[14], IPHeaderLength, 0);
+	frame[14 + 10] = sum >> 8;
+	frame[14 + 11] = sum;
+
+	memcpy(pseudo, &frame[14 + 12], 8);
+	pseudo[8] = 0;
+	pseudo[9] = frame[14 + 9];
+	pseudo[10] = (TotalLength - IPHeaderLength) >> 8;
+	pseudo[11] = TotalLength - IPHeaderLength;
+	frame[14 + IPHeaderLength + 16] = frame[14 + IPHeaderLength + 17] = 0;
+	sum = RefChecksum(&frame[14 + IPHeaderLength], TotalLength - IPHeaderLength, (u16)~RefChecksum(pseudo, sizeof(pseudo), 0));
+	frame[14 + IPHeaderLength + 16] = sum >> 8;
+	frame[14 + IPHeaderLength + 17] = sum;
+
+	*pass = 1;
+	switch(type){
+		case CSUM_TCP_OK:
+			break;
+		case CSUM_TCP_BAD_DATA:
+			frame[14 + IPHeaderLength + Random() % (TotalLength - IPHeaderLength)] ^= 1 << (Random() % 8);
+			*pass = 0;
+			break;
+		case CSUM_TCP_BAD_HEADER:
+			frame[14 + Random() % IPHeaderLength] ^= 1 << (Random() % 8);
+			*pass = ((frame[14] >> 4) != 4);	//Not IPv4 any more: left to the stack.
+			break;
+		case CSUM_TCP_FRAGMENT:
+			*pass = 0;
+			break;
+		case CSUM_TCP_PADDED:
+			for(; length < 60; length++)
+				frame[length] = Random();
+			break;
+		case CSUM_IP_BAD_IHL:
+			*pass = 0;
+			break;
+		case CSUM_IP_TRUNCATED:
+			length -= 1 + Random() % (TotalLength - IPHeaderLength);
+			*pass = 0;
+			break;
+		case CSUM_UDP_BAD:
+			frame[length - 1] ^= 0x80;
+			break;
+		case CSUM_NOT_IP:
+			frame[12] = 0x86;
+			frame[13] = 0xDD;
+			break;
+		default:
+			break;
+	}
+
+	return length;
+}
+
+static void TestRxChecksum(void){
+	static const u16 DmaMins[] = {4, 64, 256, 2048};
+	static u8 frames[4][1536];
+	unsigned int lengths[4], setting, round, i, n, expected, FramesSent, FramesPassed;
+	int pass[4];
+
+	FramesSent = FramesPassed = 0;
+	for(setting = 0; setting < 4 * 4 * 2; setting++){
+		for(round = 0; round < 64; round++){
+			SetUp();
+			SmapDriverData.EnableRxChecksum = 1;
+			SmapDriverData.DmaSliceShift = SMAP_DMA_SLICE_SHIFT_MIN + setting % 4;
+			SmapDriverData.DmaMin = DmaMins[setting / 4 % 4];
+			SmapDriverData.RxDmaPadMin = (setting / 16) ? 64 : 0;
+			SMapRxRingRefill(&SmapDriverData);
+
+			n = 1 + Random() % 4;
+			for(i = 0, expected = 0; i < n; i++){
+				lengths[i] = BuildCsumFrame(frames[i], Random() % CSUM_CASES, &pass[i]);
+				SimRxFrame(frames[i], lengths[i], 0);
+				expected += pass[i];
+			}
+
+			Receive();
+			FramesSent += n;
+			FramesPassed += SimRxDeliveredCount;
+
+			CHECK(SimRxDeliveredCount == expected, "checksum: %u of %u frames passed, expected %u (setting %u)", SimRxDeliveredCount, n, expected, setting);
+			if(SimRxDeliveredCount != expected)
+				continue;
+
+			for(i = 0, expected = 0; i < n; i++){
+				if(!pass[i]) continue;
+				CHECK(memcmp(SimRxDelivered[expected]->payload, frames[i], lengths[i]) == 0, "checksum: frame %u was corrupted (setting %u)", i, setting);
+				expected++;
+			}
+		}
+	}
+
+	SetUp();
+	CHECK(SimPbufsInUse == 0, "checksum: %d pbufs leaked", SimPbufsInUse);
+	REPORT("checksum: %u frames, %u passed on", FramesSent, FramesPassed);
+}
+
+/* Rx FIFO positions and buffers */
+
+static unsigned int BuildFrame(u8 *frame, unsigned int length){
+	unsigned int i;
+
+	for(i = 0; i < length; i++)
+		frame[i] = Random();
+	frame[0] &= ~1;	//Unicast
+	frame[12] = 0x88;	//Not IPv4
+	frame[13] = 0xB5;
+
+	return length;
+}
+
+//Frames are received correctly wherever the EMAC3 stored them, including across the end of the Rx FIFO, and after an error frame.
+static void TestRxPlacement(void){
+	static u8 frames[8][1536];
+	unsigned int lengths[8], round, i, n, expected, delivered;
+	u16 errors[8];
+
+	SetUp();
+	SMapRxRingRefill(&SmapDriverData);
+	for(round = 0, delivered = 0; round < 200; round++){
+		n = 1 + Random() % 8;
+		for(i = 0, expected = 0; i < n; i++){
+			lengths[i] = BuildFrame(frames[i], 60 + Random() % (1514 - 60 + 1));
+			errors[i] = (Random() % 8 == 0) ? SMAP_BD_RX_BADFCS : 0;
+			if(Random() % 4 == 0)
+				SimRxSkip(4 * (1 + Random() % 64));
+			SimRxFrame(frames[i], lengths[i], errors[i]);
+			if(errors[i] == 0) expected++;
+		}
+
+		Receive();
+		SMapRxRingRefill(&SmapDriverData);
+
+		CHECK(SimRxDeliveredCount == expected, "placement: %u of %u frames received, expected %u", SimRxDeliveredCount, n, expected);
+		for(i = 0, expected = 0; i < n && expected < SimRxDeliveredCount; i++){
+			if(errors[i] != 0) continue;
+			CHECK(memcmp(SimRxDelivered[expected]->payload, frames[i], lengths[i]) == 0, "placement: frame %u of round %u was corrupted", i, round);
+			CHECK(SimRxDelivered[expected]->len == SimRxDelivered[expected]->tot_len, "placement: frame %u of round %u was received into a chained buffer", i, round);
+			expected++;
+		}
+		delivered += SimRxDeliveredCount;
+
+		//Keep the Rx FIFO position, but let go of the frames.
+		for(i = 0; i < SimRxDeliveredCount; i++)
+			pbuf_free(SimRxDelivered[i]);
+		SimRxDeliveredCount = 0;
+	}
+
+	CHECK(SmapDriverData.RuntimeStats.RxFrameCount == delivered, "placement: RxFrameCount is %u, expected %u", (unsigned int)SmapDriverData.RuntimeStats.RxFrameCount, delivered);
+	SetUp();
+	CHECK(SimPbufsInUse == 0, "placement: %d pbufs leaked", SimPbufsInUse);
+}
+
+//With rxpad, only frames followed by another frame are over-read, so the Rx FIFO is never read past the last frame stored.
+static void TestRxDmaPadding(void){
+	static u8 frames[4][1536];
+	unsigned int lengths[4], round, i, n;
+
+	for(round = 0; round < 200; round++){
+		SetUp();
+		SmapDriverData.RxDmaPadMin = 64;
+		SmapDriverData.DmaSliceShift = SMAP_DMA_SLICE_SHIFT_MIN + Random() % 4;
+		SMapRxRingRefill(&SmapDriverData);
+
+		n = 1 + Random() % 4;
+		for(i = 0; i < n; i++){
+			lengths[i] = BuildFrame(frames[i], 64 + Random() % (1514 - 64 + 1));
+			SimRxFrame(frames[i], lengths[i], 0);
+		}
+		Receive();
+
+		CHECK(SimRxOverreads == 0, "rxpad: the Rx FIFO was read past the last frame (%u frames, block size %u)", n, 1 << SmapDriverData.DmaSliceShift);
+		CHECK(SimRxDeliveredCount == n, "rxpad: %u of %u frames received", SimRxDeliveredCount, n);
+		for(i = 0; i < n && i < SimRxDeliveredCount; i++)
+			CHECK(memcmp(SimRxDelivered[i]->payload, frames[i], lengths[i]) == 0, "rxpad: frame %u was corrupted", i);
+	}
+	SetUp();
+}
+
+//The Rx ring gives up on buffers that are too small, instead of allocating forever.
+static void TestRxRingSmallBuffers(void){
+	static u8 frame[1514];
+
+	SetUp();
+	SmapDriverData.RxDmaPadMin = 64;
+	SimPbufPoolBufSize = 1520;
+	SMapRxRingRefill(&SmapDriverData);
+	CHECK(SmapDriverData.RxDmaPadMin == 0, "ring: Rx DMA padding was not disabled for %u byte buffers", SimPbufPoolBufSize);
+	CHECK(!SmapDriverData.RxRingDisabled && SmapDriverData.RxRingFillIndex == SMAP_RX_RING_SIZE, "ring: not filled with %u byte buffers", SimPbufPoolBufSize);
+
+	SetUp();
+	SimPbufPoolBufSize = 1024;
+	SMapRxRingRefill(&SmapDriverData);
+	CHECK(SmapDriverData.RxRingDisabled && SmapDriverData.RxRingFillIndex == 0, "ring: not disabled with %u byte buffers", SimPbufPoolBufSize);
+	SMapRxRingRefill(&SmapDriverData);
+	CHECK(SimPbufsInUse == 0, "ring: %d pbufs held with %u byte buffers", SimPbufsInUse, SimPbufPoolBufSize);
+
+	//Frames that fit into one buffer are still received. Longer ones are dropped, instead of being copied past the end of the first buffer of a chain.
+	SimRxFrame(frame, BuildFrame(frame, 1000), 0);
+	SimRxFrame(frame, BuildFrame(frame, 1514), 0);
+	Receive();
+	CHECK(SimRxDeliveredCount == 1 && SimRxDelivered[0]->next == NULL && SimRxDelivered[0]->tot_len == 1000, "ring: a short frame was not received with %u byte buffers", SimPbufPoolBufSize);
+	CHECK(SmapDriverData.RuntimeStats.RxAllocFail == 1, "ring: a long frame was not dropped with %u byte buffers", SimPbufPoolBufSize);
+
+	SimPbufPoolBufSize = 1536;
+	SetUp();
+}
+
+/* Tx FIFO writes of pbuf chains */
+
+static void TestTxChains(void){
+	static const u16 DmaMins[] = {4, 64, 2048};
+	static u8 data[1514], fifo[1514 + 4];
+	struct pbuf *head, *tail, *p;
+	unsigned int setting, round, i, n, length, segment, offset, pointer;
+	u16 size;
+
+	for(setting = 0; setting < 4 * 3 * 2; setting++){
+		SetUp();
+		SmapDriverData.DmaSliceShift = SMAP_DMA_SLICE_SHIFT_MIN + setting % 4;
+		SmapDriverData.DmaMin = DmaMins[setting / 4 % 3];
+		SmapDriverData.TxDmaPadMin = (setting / 12) ? 64 : 0;
+
+		for(round = 0; round < 128; round++){
+			length = 14 + Random() % (1514 - 14 + 1);
+			for(i = 0; i < length; i++)
+				data[i] = Random();
+
+			//Split the frame into up to 5 segments of random lengths and alignments, like a chain from lwIP.
+			n = 1 + Random() % 5;
+			head = tail = NULL;
+			for(i = 0; i < length; i += segment){
+				segment = (n-- <= 1) ? length - i : Random() % (length - i + 1);
+				offset = Random() % 4;
+				p = SimPbufRef(&data[i], segment, offset);
+				if(tail != NULL) tail->next = p;
+				else head = p;
+				tail = p;
+			}
+			for(p = head, i = length; p != NULL; p = p->next){
+				p->tot_len = i;
+				i -= p->len;
+			}
+
+			//Make room for the frame.
+			SmapDriverData.TxBufferSpaceAvailable = SMAP_TX_BUFSIZE;
+			SmapDriverData.NumPacketsInTx = 0;
+
+			pointer = SMAP_TX_BASE + SmapDriverData.TxFifoWrPtr;
+			CHECK(SMapTransmitFrame(&SmapDriverData, head, length) == 1, "tx: a %u byte frame was not sent", length);
+			SimTxFifoRead(pointer, fifo, length);
+			CHECK(memcmp(fifo, data, length) == 0, "tx: a %u byte frame in %u segments was corrupted (setting %u)", length, (unsigned int)(tail == head ? 1 : 2), setting);
+
+			i = (SmapDriverData.TxBDIndex - 1) % SMAP_BD_MAX_ENTRY;
+			size = SmapDriverData.TxBDSize[i];
+			CHECK(SimTxBD[i].pointer == pointer && SimTxBD[i].length == length, "tx: bad BD (pointer 0x%x, length %u)", SimTxBD[i].pointer, SimTxBD[i].length);
+			CHECK(size % 4 == 0 && size >= ((length + 3) & ~3), "tx: %u bytes were accounted for a %u byte frame", size, length);
+			CHECK(SmapDriverData.TxFifoWrPtr == (pointer - SMAP_TX_BASE + size) % SMAP_TX_BUFSIZE, "tx: the write pointer was not advanced by the space used");
+
+			pbuf_free(head);
+		}
+	}
+
+	SetUp();
+	CHECK(SimPbufsInUse == 0, "tx: %d pbufs leaked", SimPbufsInUse);
+}
+
+/* Multicast hash */
+
+//Reference: the CRC-32 of Ethernet, computed bit-reflected. The hash of the IBM EMAC uses the unreflected CRC, without the final inversion.
+static u32 RefCrc32Reflected(const u8 *data, unsigned int length){
+	unsigned int i, j;
+	u32 crc;
+
+	crc = 0xFFFFFFFF;
+	for(i = 0; i < length; i++){
+		crc ^= data[i];
+		for(j = 0; j < 8; j++)
+			crc = (crc >> 1) ^ ((crc & 1) ? 0xEDB88320 : 0);
+	}
+
+	return crc;
+}
+
+static u32 BitReverse32(u32 value){
+	u32 result;
+	unsigned int i;
+
+	for(i = 0, result = 0; i < 32; i++, value >>= 1)
+		result = result << 1 | (value & 1);
+
+	return result;
+}
+
+//Returns the bit of the group hash for address, as in the Linux ibm_emac driver: slot 63 - (CRC >> 26), 16 bits per register, MSB first.
+static void RefHashBit(const u8 *address, unsigned int *reg, u32 *mask){
+	unsigned int slot;
+
+	slot = 63 - (BitReverse32(RefCrc32Reflected(address, 6)) >> 26);
+	*reg = SMAP_R_EMAC3_GROUP_HASH1 + (slot >> 4) * (SMAP_R_EMAC3_GROUP_HASH2 - SMAP_R_EMAC3_GROUP_HASH1);
+	*mask = 0x8000 >> (slot & 0xF);
+}
+
+static u32 HashRegister(unsigned int reg){
+	return *(u32*)&SimEmac3Regs[reg];
+}
+
+static void TestMulticastHash(void){
+	static const u8 check[] = "123456789";
+	u8 address[6], other[6];
+	unsigned int i, round, reg, reg2;
+	u32 mask, mask2, total;
+
+	CHECK(~RefCrc32Reflected(check, 9) == 0xCBF43926, "multicast: the reference CRC is wrong");
+
+	for(round = 0; round < 256; round++){
+		SetUp();
+		for(i = 0; i < 6; i++)
+			address[i] = Random();
+		address[0] |= 1;
+		RefHashBit(address, &reg, &mask);
+
+		CHECK(SMapMulticastAdd(address) == 0, "multicast: add failed");
+		CHECK(HashRegister(reg) == mask, "multicast: %02x:%02x:%02x:%02x:%02x:%02x set 0x%08x in 0x%x, expected 0x%08x",
+			address[0], address[1], address[2], address[3], address[4], address[5], HashRegister(reg), reg, mask);
+		for(i = 0, total = 0; i < 4; i++)
+			total += __builtin_popcount(HashRegister(SMAP_R_EMAC3_GROUP_HASH1 + i * (SMAP_R_EMAC3_GROUP_HASH2 - SMAP_R_EMAC3_GROUP_HASH1)));
+		CHECK(total == 1, "multicast: %u bits set for one address", total);
+
+		//A second address that maps to the same bit keeps it set until both are deleted.
+		do{
+			for(i = 0; i < 6; i++)
+				other[i] = Random();
+			other[0] |= 1;
+			RefHashBit(other, &reg2, &mask2);
+		}while(reg2 != reg || mask2 != mask || memcmp(other, address, 6) == 0);
+
+		SMapMulticastAdd(address);
+		SMapMulticastAdd(other);
+		SMapMulticastDel(address);
+		SMapMulticastDel(address);
+		CHECK(HashRegister(reg) == mask, "multicast: bit cleared while still in use");
+		SMapMulticastDel(other);
+		CHECK(HashRegister(reg) == 0, "multicast: bit not cleared");
+		SMapMulticastDel(other);
+		CHECK(HashRegister(reg) == 0, "multicast: deleting once too often changed the hash");
+	}
+
+	address[0] = 0x02;
+	CHECK(SMapMulticastAdd(address) < 0, "multicast: a unicast address was accepted");
+	SetUp();
+}
+
+/* Early Rx filter */
+
+struct FilterFrame{
+	const char *name;
+	u8 dst[6];
+	u16 EtherType;
+	u8 protocol;
+	u8 ihl;		//In words
+	u16 fragment;	//Flags and offset
+	u32 DstAddr;
+	u16 DstPort;
+};
+
+static unsigned int BuildFilterFrame(u8 *frame, const struct FilterFrame *f){
+	unsigned int length, ihl;
+
+	length = BuildFrame(frame, 128);
+	memcpy(frame, f->dst, 6);
+	frame[12] = f->EtherType >> 8;
+	frame[13] = f->EtherType;
+	if(f->EtherType == 0x0800){
+		ihl = f->ihl ? f->ihl : 5;
+		frame[14] = 0x40 | ihl;
+		frame[14 + 2] = 0;
+		frame[14 + 3] = length - 14;
+		frame[14 + 6] = f->fragment >> 8;
+		frame[14 + 7] = f->fragment;
+		frame[14 + 9] = f->protocol;
+		frame[14 + 16] = f->DstAddr >> 24;
+		frame[14 + 17] = f->DstAddr >> 16;
+		frame[14 + 18] = f->DstAddr >> 8;
+		frame[14 + 19] = f->DstAddr;
+		frame[14 + ihl * 4 + 2] = f->DstPort >> 8;
+		frame[14 + ihl * 4 + 3] = f->DstPort;
+	}
+
+	return length;
+}
+
+static void TestRxFilter(void){
+	static const struct FilterFrame frames[] = {
+		{"ARP broadcast",	{0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}, 0x0806, 0, 0, 0, 0, 0},
+		{"UDP 5000",		{0x00, 0x11, 0x22, 0x33, 0x44, 0x55}, 0x0800, 17, 5, 0x4000, 0xC0A80002, 5000},
+		{"UDP 5000, options",	{0x00, 0x11, 0x22, 0x33, 0x44, 0x55}, 0x0800, 17, 8, 0x4000, 0xC0A80002, 5000},
+		{"UDP fragment",	{0x00, 0x11, 0x22, 0x33, 0x44, 0x55}, 0x0800, 17, 5, 0x0010, 0xC0A80002, 5000},
+		{"TCP 80",		{0x00, 0x11, 0x22, 0x33, 0x44, 0x55}, 0x0800, 6, 5, 0x4000, 0xC0A80002, 80},
+		{"UDP multicast",	{0x01, 0x00, 0x5E, 0x00, 0x00, 0xFB}, 0x0800, 17, 5, 0x0000, 0xE00000FB, 5353},
+		{"UDP other subnet",	{0x00, 0x11, 0x22, 0x33, 0x44, 0x55}, 0x0800, 17, 5, 0x4000, 0x0A000002, 5000},
+	};
+	static const struct{
+		const char *name;
+		struct SmapRxFilterRule rules[3];
+		unsigned int dropped;	//Bit for each frame of frames[] that is to be dropped.
+	} cases[] = {
+		{"drop ARP",		{{SMAP_RX_FILTER_DROP, SMAP_RX_FILTER_ETHERTYPE, 0, 0, 0x0806, 0, 0, 0, 0}}, 0x01},
+		{"drop broadcast",	{{SMAP_RX_FILTER_DROP, SMAP_RX_FILTER_DST_CLASS, SMAP_RX_FILTER_BROADCAST, 0, 0, 0, 0, 0, 0}}, 0x01},
+		{"drop multicast",	{{SMAP_RX_FILTER_DROP, SMAP_RX_FILTER_DST_CLASS, SMAP_RX_FILTER_MULTICAST, 0, 0, 0, 0, 0, 0}}, 0x20},
+		{"drop UDP",		{{SMAP_RX_FILTER_DROP, SMAP_RX_FILTER_IP_PROTO, 0, 17, 0, 0, 0, 0, 0}}, 0x6E},
+		//A fragment that is not the first one carries no ports, so a port rule does not match it.
+		{"drop ports 4000-6000",	{{SMAP_RX_FILTER_DROP, SMAP_RX_FILTER_DST_PORT, 0, 0, 0, 4000, 6000, 0, 0}}, 0x66},
+		{"drop 192.168.0.0/16",	{{SMAP_RX_FILTER_DROP, SMAP_RX_FILTER_IP_DST, 0, 0, 0, 0, 0, 0xC0A80000, 0xFFFF0000}}, 0x1E},
+		{"accept TCP, drop IPv4",	{{SMAP_RX_FILTER_ACCEPT, SMAP_RX_FILTER_IP_PROTO, 0, 6, 0, 0, 0, 0, 0},
+					 {SMAP_RX_FILTER_DROP, SMAP_RX_FILTER_ETHERTYPE, 0, 0, 0x0800, 0, 0, 0, 0}}, 0x6E},
+		{"drop all",		{{SMAP_RX_FILTER_DROP, 0, 0, 0, 0, 0, 0, 0, 0}}, 0x7F},
+	};
+	static u8 frame[sizeof(frames) / sizeof(frames[0])][128];
+	unsigned int c, i, j, n, length, expected;
+	u32 hits;
+
+	n = sizeof(frames) / sizeof(frames[0]);
+	for(c = 0; c < sizeof(cases) / sizeof(cases[0]); c++){
+		SetUp();
+		for(i = 0; i < 3; i++)
+			CHECK(SMapRxFilterSet(i, cases[c].rules[i].action != SMAP_RX_FILTER_NONE ? &cases[c].rules[i] : NULL) == 0, "filter: %s: rule %u rejected", cases[c].name, i);
+
+		for(i = 0, expected = 0; i < n; i++){
+			length = BuildFilterFrame(frame[i], &frames[i]);
+			SimRxFrame(frame[i], length, 0);
+			if(!(cases[c].dropped & (1 << i))) expected++;
+		}
+		Receive();
+
+		CHECK(SimRxDeliveredCount == expected, "filter: %s: %u frames accepted, expected %u", cases[c].name, SimRxDeliveredCount, expected);
+		for(i = 0, j = 0; i < n && j < SimRxDeliveredCount; i++){
+			if(cases[c].dropped & (1 << i)) continue;
+			CHECK(memcmp(SimRxDelivered[j]->payload, frame[i], 6) == 0, "filter: %s: %s was dropped", cases[c].name, frames[i].name);
+			j++;
+		}
+		CHECK(SmapDriverData.RuntimeStats.RxFilterDropCount == n - expected, "filter: %s: RxFilterDropCount is %u", cases[c].name, (unsigned int)SmapDriverData.RuntimeStats.RxFilterDropCount);
+		for(i = 0, hits = 0; i < 3; i++)
+			hits += SMapRxFilterGetHits(i);
+		CHECK(hits >= n - expected, "filter: %s: only %u hits", cases[c].name, (unsigned int)hits);
+
+		SMapRxFilterClear();
+	}
+
+	CHECK(SMapRxFilterSet(SMAP_RX_FILTER_MAX, NULL) < 0, "filter: an invalid index was accepted");
+	SetUp();
+}
+
+/* DEV9 bus accesses per frame */
+
+//A TCP segment from lwIP: a 54-byte header pbuf, then the payload. The carry-over word of the header must not keep the payload from being transferred with DMA.
+static void TestTxTcpChain(void){
+	static u8 data[54 + 1460], fifo[54 + 1460 + 4];
+	struct pbuf *header, *payload;
+	unsigned int offset, i;
+
+	for(offset = 0; offset < 4; offset++){
+		SetUp();
+		for(i = 0; i < sizeof(data); i++)
+			data[i] = Random();
+		header = SimPbufRef(data, 54, 0);
+		payload = SimPbufRef(&data[54], 1460, offset);
+		header->next = payload;
+		header->tot_len = sizeof(data);
+
+		CHECK(SMapTransmitFrame(&SmapDriverData, header, sizeof(data)) == 1, "tcp chain: not sent");
+		SimTxFifoRead(SMAP_TX_BASE, fifo, sizeof(data));
+		CHECK(memcmp(fifo, data, sizeof(data)) == 0, "tcp chain: corrupted (payload offset %u)", offset);
+		//All whole DMA blocks of the payload, less the bytes that complete the carry-over word.
+		CHECK(SimDmaBytes >= ((1460 - 4) & ~63), "tcp chain: only %u bytes transferred with DMA (payload offset %u, %u register accesses)", SimDmaBytes, offset, SimRegAccesses);
+
+		pbuf_free(header);
+	}
+	SetUp();
+}
+
+static void ReportBusAccesses(void){
+	static u8 data[1514];
+	struct pbuf *p;
+	unsigned int i, frames;
+
+	SetUp();
+	SMapRxRingRefill(&SmapDriverData);
+	for(i = 0, frames = 0; i < 8; i++, frames++)
+		SimRxFrame(data, BuildFrame(data, 1514), 0);
+	Receive();
+	REPORT("bus: Rx of 1514 byte frames: %.1f register accesses and %u DMA bytes per frame", (double)SimRegAccesses / frames, SimDmaBytes / frames);
+
+	SetUp();
+	for(i = 0, frames = 0; i < 2; i++, frames++){
+		p = SimPbufRef(data, 1514, 0);
+		SMapTransmitFrame(&SmapDriverData, p, 1514);
+		pbuf_free(p);
+	}
+	REPORT("bus: Tx of 1514 byte frames: %.1f register accesses and %u DMA bytes per frame", (double)SimRegAccesses / frames, SimDmaBytes / frames);
+	SetUp();
+}
+
+/* Test runner */
+
+static const struct{
+	const char *name;
+	void (*test)(void);
+} UnitTests[] = {
+	{"checksum",	&TestRxChecksum},
+	{"placement",	&TestRxPlacement},
+	{"rxpad",	&TestRxDmaPadding},
+	{"ring",	&TestRxRingSmallBuffers},
+	{"tx",		&TestTxChains},
+	{"tcp chain",	&TestTxTcpChain},
+	{"multicast",	&TestMulticastHash},
+	{"filter",	&TestRxFilter},
+	{"bus",		&ReportBusAccesses},
+};
+
+static const struct{
+	const char *name;
+	void (*test)(unsigned int arg);
+} DriverTests[] = {
+	{"boot",	&TestBoot},
+	{"pause",	&TestPhyPause},
+	{"fallback",	&TestPhyFallback},
+	{"link errors",	&TestPhyLinkErrors},
+	{"warm",	&TestPhyWarmStart},
+	{"fast relink",	&TestLinkFastRelink},
+	{"full relink",	&TestLinkFullRelink},
+	{"stop",	&TestStopStart},
+	{"netif",	&TestNetif},
+	{"rx intr",	&TestRxIntr},
+	{"rx poll",	&TestRxPolling},
+	{"rx pause",	&TestRxPause},
+	{"tx classes",	&TestTxClasses},
+	{"bql",		&TestTxQueueLimit},
+	{"tx direct",	&TestTxDirect},
+	{"txend",	&TestTxEnd},
+	{"tx errors",	&TestTxErrors},
+};
+
+void RunIsolated(const char *name, void (*test)(unsigned int arg), unsigned int arg){
+	pid_t pid;
+	int status, fd;
+
+	fflush(stdout);
+	fflush(stderr);
+	if((pid = fork()) < 0){
+		perror("fork");
+		exit(2);
+	}
+
+	if(pid == 0){
+		if(!verbose && (fd = open("/dev/null", O_WRONLY)) >= 0){
+			dup2(fd, STDOUT_FILENO);
+			close(fd);
+		}
+
+		failures = 0;
+		test(arg);
+		fflush(stdout);
+		fflush(stderr);
+		_exit(failures != 0);
+	}
+
+	if(waitpid(pid, &status, 0) < 0){
+		perror("waitpid");
+		exit(2);
+	}
+	if(WIFSIGNALED(status)){
+		fprintf(stderr, "FAIL %s: killed by signal %d\n", name, WTERMSIG(status));
+		failures++;
+	}
+	else if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		failures++;
+}
+
+static void RunUnitTest(unsigned int index){
+	UnitTests[index].test();
+}
+
+//Returns non-zero if the test was selected on the command line, or if none were.
+static int IsSelected(const char *name, int argc, char *argv[]){
+	int i, selected;
+
+	for(i = 1, selected = 1; i < argc; i++){
+		if(argv[i][0] == '-') continue;
+		if(strcmp(argv[i], name) == 0) return 1;
+		selected = 0;
+	}
+
+	return selected;
+}
+
+int main(int argc, char *argv[]){
+	unsigned int i;
+
+	if(argc > 1 && strcmp(argv[1], "-v") == 0)
+		verbose = 1;
+
+	for(i = 0; i < sizeof(UnitTests) / sizeof(UnitTests[0]); i++){
+		if(IsSelected(UnitTests[i].name, argc, argv))
+			RunIsolated(UnitTests[i].name, &RunUnitTest, i);
+	}
+	for(i = 0; i < sizeof(DriverTests) / sizeof(DriverTests[0]); i++){
+		if(IsSelected(DriverTests[i].name, argc, argv))
+			RunIsolated(DriverTests[i].name, DriverTests[i].test, 0);
+	}
+
+	if(failures != 0){
+		printf("%u tests failed\n", failures);
+		return 1;
+	}
+
+	printf("All tests passed.\n");
+	return 0;
+}
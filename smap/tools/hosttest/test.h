@@ -0,0 +1,40 @@
+/*	Shared by the tests. Each test is run in a process of its own (see RunIsolated() in smaptest.c).
+	The results go to stderr, as stdout carries the messages of the driver, which are only shown with -v.	*/
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+#include <tamtypes.h>
+
+extern unsigned int failures;
+
+#define CHECK(cond, ...)	do{ if(!(cond)){ failures++; fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); } }while(0)
+#define REPORT(...)		do{ fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); }while(0)
+
+u32 Random(void);
+
+//Runs test(arg) in a child process, so that it starts with the driver unloaded. A test that fails or crashes counts as one failure here.
+void RunIsolated(const char *name, void (*test)(unsigned int arg), unsigned int arg);
+
+/* Tests of the whole driver, loaded like on the IOP (drivertest.c) */
+void TestBoot(unsigned int arg);
+void TestPhyPause(unsigned int arg);
+void TestPhyFallback(unsigned int arg);
+void TestPhyLinkErrors(unsigned int arg);
+void TestPhyWarmStart(unsigned int arg);
+void TestLinkFastRelink(unsigned int arg);
+void TestLinkFullRelink(unsigned int arg);
+void TestStopStart(unsigned int arg);
+void TestNetif(unsigned int arg);
+void TestRxIntr(unsigned int arg);
+void TestRxPolling(unsigned int arg);
+void TestRxPause(unsigned int arg);
+void TestTxClasses(unsigned int arg);
+void TestTxQueueLimit(unsigned int arg);
+void TestTxDirect(unsigned int arg);
+void TestTxEnd(unsigned int arg);
+void TestTxErrors(unsigned int arg);
+
+#endif
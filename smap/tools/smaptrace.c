@@ -0,0 +1,237 @@
+/*	Prints the latency of each stage of the SMAP driver's hot paths, from a dump made with SMapTraceDump().
+	The dump is the buffer that SMapTraceDump() filled, saved as-is.
+
+	This is a host tool. Build it with:
+		cc -O2 -o smaptrace smaptrace.c
+	Usage:
+		smaptrace <dump file>
+
+	The layout of the dump must match struct SmapTraceHeader and struct SmapTraceRecord in ps2smap.h. It is little-endian, like the IOP.	*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SMAP_TRACE_MAGIC	0x52544D53
+#define SMAP_TRACE_VERSION	1
+
+#define SMAP_TRACE_INTR		0
+#define SMAP_TRACE_WAKEUP	1
+#define SMAP_TRACE_RX_BD	2
+#define SMAP_TRACE_DMA_START	3
+#define SMAP_TRACE_DMA_END	4
+#define SMAP_TRACE_RX_HANDOFF	5
+#define SMAP_TRACE_TX_ARM	6
+#define SMAP_TRACE_TX_DONE	7
+#define SMAP_TRACE_STAGES	8
+
+#define SMAP_TRACE_DMA_TX	0x8000
+
+#define HEADER_SIZE	16
+#define RECORD_SIZE	8
+
+//Tx BDs that can be outstanding at once. Must be a power of 2.
+#define TX_PENDING_MAX	64
+
+//Latency histograms, with buckets of powers of 2 microseconds.
+#define HISTOGRAM_BUCKETS	24
+
+enum METRIC{
+	METRIC_INTR_WAKEUP=0,	//Interrupt raised -> interrupt handler thread running.
+	METRIC_WAKEUP_RX_BD,	//Interrupt handler thread running -> first Rx BD read.
+	METRIC_RX_PASS,		//First Rx BD read -> frames handed over to ps2ip.
+	METRIC_INTR_HANDOFF,	//Interrupt raised -> frames handed over to ps2ip.
+	METRIC_DMA_RX,		//Rx DMA transfer.
+	METRIC_DMA_TX,		//Tx DMA transfer.
+	METRIC_TX_ARM_DONE,	//Tx BD marked ready -> Tx BD reclaimed.
+
+	METRIC_COUNT
+};
+
+static const char *MetricNames[METRIC_COUNT]={
+	"interrupt -> thread wakeup",
+	"thread wakeup -> first Rx BD",
+	"first Rx BD -> ps2ip handoff",
+	"interrupt -> ps2ip handoff",
+	"Rx DMA",
+	"Tx DMA",
+	"Tx BD armed -> reclaimed",
+};
+
+static const char *StageNames[SMAP_TRACE_STAGES]={
+	"INTR", "WAKEUP", "RX_BD", "DMA_START", "DMA_END", "RX_HANDOFF", "TX_ARM", "TX_DONE"
+};
+
+struct histogram{
+	unsigned long count;
+	double sum, min, max;
+	unsigned long buckets[HISTOGRAM_BUCKETS];
+};
+
+static struct histogram histograms[METRIC_COUNT];
+static double clock_hz;
+
+static unsigned int get16(const unsigned char *p){
+	return p[0] | p[1]<<8;
+}
+
+static unsigned long get32(const unsigned char *p){
+	return (unsigned long)p[0] | (unsigned long)p[1]<<8 | (unsigned long)p[2]<<16 | (unsigned long)p[3]<<24;
+}
+
+//Records the time between two timer counts. The timer is 32-bit and may have wrapped around in between.
+static void sample(enum METRIC metric, unsigned long from, unsigned long to){
+	struct histogram *h;
+	double usec;
+	int bucket;
+
+	usec=(double)((to-from)&0xFFFFFFFFUL)*1000000.0/clock_hz;
+	h=&histograms[metric];
+
+	if(h->count==0 || usec<h->min) h->min=usec;
+	if(h->count==0 || usec>h->max) h->max=usec;
+	h->count++;
+	h->sum+=usec;
+
+	for(bucket=0; bucket<HISTOGRAM_BUCKETS-1 && usec>=(double)(1UL<<bucket); bucket++){};
+	h->buckets[bucket]++;
+}
+
+static void print_histogram(enum METRIC metric){
+	struct histogram *h;
+	unsigned long peak;
+	int i, first, last, width;
+
+	h=&histograms[metric];
+	printf("%s: %lu samples", MetricNames[metric], h->count);
+	if(h->count==0){
+		printf("\n\n");
+		return;
+	}
+	printf(", min %.1fus, avg %.1fus, max %.1fus\n", h->min, h->sum/h->count, h->max);
+
+	for(first=0; h->buckets[first]==0; first++){};
+	for(last=HISTOGRAM_BUCKETS-1; h->buckets[last]==0; last--){};
+	for(peak=0,i=first; i<=last; i++)
+		if(h->buckets[i]>peak) peak=h->buckets[i];
+
+	for(i=first; i<=last; i++){
+		if(i==0) printf("  %10s <%8luus %8lu ", "", 1UL, h->buckets[i]);
+		else printf("  %10lu -%8luus %8lu ", 1UL<<(i-1), (1UL<<i)-1, h->buckets[i]);
+		for(width=(int)(h->buckets[i]*50/peak); width>0; width--) putchar('#');
+		putchar('\n');
+	}
+	putchar('\n');
+}
+
+int main(int argc, char *argv[]){
+	FILE *file;
+	unsigned char header[HEADER_SIZE], record[RECORD_SIZE];
+	unsigned long magic, lost, time, count, i;
+	unsigned long LastIntr, LastWakeup, LastDmaStart, PassStart, TxPending[TX_PENDING_MAX];
+	unsigned long StageCount[SMAP_TRACE_STAGES];
+	unsigned int version, stage, arg, TxHead, TxTail;
+	int HaveIntr, IntrPending, HaveWakeup, HaveDmaStart, InPass, metric;
+
+	if(argc!=2){
+		fprintf(stderr, "Usage: %s <dump file>\n", argv[0]);
+		return 1;
+	}
+
+	if((file=fopen(argv[1], "rb"))==NULL){
+		perror(argv[1]);
+		return 1;
+	}
+
+	if(fread(header, 1, HEADER_SIZE, file)!=HEADER_SIZE){
+		fprintf(stderr, "%s: truncated header\n", argv[1]);
+		fclose(file);
+		return 1;
+	}
+
+	magic=get32(&header[0]);
+	version=get16(&header[4]);
+	count=get16(&header[6]);
+	clock_hz=(double)get32(&header[8]);
+	lost=get32(&header[12]);
+	if(magic!=SMAP_TRACE_MAGIC || version!=SMAP_TRACE_VERSION || clock_hz==0){
+		fprintf(stderr, "%s: not a SMAP trace dump (magic 0x%08lx, version %u)\n", argv[1], magic, version);
+		fclose(file);
+		return 1;
+	}
+
+	printf("%lu records, %lu older records lost, timer at %.0fHz\n\n", count, lost, clock_hz);
+
+	memset(StageCount, 0, sizeof(StageCount));
+	HaveIntr=IntrPending=HaveWakeup=HaveDmaStart=InPass=0;
+	LastIntr=LastWakeup=LastDmaStart=PassStart=0;
+	TxHead=TxTail=0;
+
+	for(i=0; i<count; i++){
+		if(fread(record, 1, RECORD_SIZE, file)!=RECORD_SIZE){
+			fprintf(stderr, "%s: truncated after %lu records\n", argv[1], i);
+			break;
+		}
+
+		time=get32(&record[0]);
+		stage=record[4];
+		arg=get16(&record[6]);
+		if(stage>=SMAP_TRACE_STAGES) continue;
+		StageCount[stage]++;
+
+		switch(stage){
+			case SMAP_TRACE_INTR:
+				LastIntr=time;
+				HaveIntr=IntrPending=1;
+				break;
+			case SMAP_TRACE_WAKEUP:
+				//Only the first wakeup after an interrupt is attributed to it.
+				if(IntrPending) sample(METRIC_INTR_WAKEUP, LastIntr, time);
+				IntrPending=0;
+				LastWakeup=time;
+				HaveWakeup=1;
+				InPass=0;
+				break;
+			case SMAP_TRACE_RX_BD:
+				if(!InPass){
+					if(HaveWakeup) sample(METRIC_WAKEUP_RX_BD, LastWakeup, time);
+					PassStart=time;
+					InPass=1;
+				}
+				break;
+			case SMAP_TRACE_DMA_START:
+				LastDmaStart=time;
+				HaveDmaStart=(arg&SMAP_TRACE_DMA_TX)?2:1;
+				break;
+			case SMAP_TRACE_DMA_END:
+				if(HaveDmaStart) sample(HaveDmaStart==2?METRIC_DMA_TX:METRIC_DMA_RX, LastDmaStart, time);
+				HaveDmaStart=0;
+				break;
+			case SMAP_TRACE_RX_HANDOFF:
+				if(InPass) sample(METRIC_RX_PASS, PassStart, time);
+				if(HaveIntr) sample(METRIC_INTR_HANDOFF, LastIntr, time);
+				InPass=0;
+				HaveIntr=0;
+				break;
+			case SMAP_TRACE_TX_ARM:
+				//Tx BDs complete in the order that they were armed.
+				if(TxHead-TxTail<TX_PENDING_MAX) TxPending[TxHead++%TX_PENDING_MAX]=time;
+				break;
+			case SMAP_TRACE_TX_DONE:
+				if(TxHead!=TxTail) sample(METRIC_TX_ARM_DONE, TxPending[TxTail++%TX_PENDING_MAX], time);
+				break;
+		}
+	}
+
+	fclose(file);
+
+	printf("Records per stage:\n");
+	for(stage=0; stage<SMAP_TRACE_STAGES; stage++)
+		printf("  %-10s %8lu\n", StageNames[stage], StageCount[stage]);
+	putchar('\n');
+
+	for(metric=0; metric<METRIC_COUNT; metric++)
+		print_histogram(metric);
+
+	return 0;
+}
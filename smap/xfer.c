@@ -25,71 +25,474 @@ extern void *_gp;
 extern struct SmapDriverData SmapDriverData;
 
 static int SmapDmaTransfer(volatile u8 *smap_regbase, void *buffer, unsigned int size, int direction){
-	unsigned int NumBlocks;
+	unsigned int NumBlocks, shift;
 	int result;
 
 	/*	Non-Sony: the original block size was (32*4 = 128) bytes.
-		However, that resulted in slightly lower performance due to the IOP needing to copy more data.	*/
-	if((NumBlocks=size>>6)>0){
-		if(dev9DmaTransfer(1, buffer, NumBlocks<<16|0x10, direction)>=0){
-			result=NumBlocks<<6;
+		However, that resulted in slightly lower performance due to the IOP needing to copy more data.
+		The block size (64 bytes by default) and the smallest transfer to use DMA for are set with the dmaslice= and dmamin= options, or by -calibrate. */
+	shift=SmapDriverData.DmaSliceShift;
+	if(size>=SmapDriverData.DmaMin && (NumBlocks=size>>shift)>0){
+		SMAP_TRACE_POINT(SMAP_TRACE_DMA_START, (NumBlocks<<shift)|(direction==DMAC_TO_MEM?0:SMAP_TRACE_DMA_TX));
+		if(dev9DmaTransfer(1, buffer, NumBlocks<<16|1<<(shift-2), direction)>=0){
+			result=NumBlocks<<shift;
 		}
 		else result=0;
+		SMAP_TRACE_POINT(SMAP_TRACE_DMA_END, result);
 	}
 	else result=0;
 
 	return result;
 }
 
-static inline void CopyFromFIFO(volatile u8 *smap_regbase, void *buffer, unsigned int length, u16 RxBdPtr){
-	int i, result;
+//Returns the histogram bucket of value: 0 for 0, 1 for 1, 2 for 2-3, 3 for 4-7 and so on, up to buckets-1.
+static inline unsigned int SMapStatsBucket(u32 value, unsigned int buckets){
+	unsigned int bucket;
+
+	for(bucket=0; value!=0 && bucket<buckets-1; bucket++)
+		value>>=1;
+
+	return bucket;
+}
+
+//Rounds size up to a whole number of DMA blocks.
+static inline unsigned int SmapDmaRoundUp(unsigned int size){
+	return (size+(1<<SmapDriverData.DmaSliceShift)-1)&~((1<<SmapDriverData.DmaSliceShift)-1);
+}
+
+/*	Non-Sony: the Rx transfers are not overlapped with other work.
+	dev9DmaTransfer() busy-waits for the DMA transfer to complete (and Dev9PostDmaCbHandler() for the FIFO to finish), within the caller's thread.
+	The DEV9 DMA channel (and its lock) is also shared with the ATA driver, so it cannot be programmed directly to run asynchronously.
+	Instead, the work done between two transfers is kept to a minimum: buffers come from a pre-allocated ring and frames are handed to ps2ip once per pass.
+
+	If sum is not NULL, the 16-bit ones'-complement sum of the frame (in the byte order of the IOP, over whole words) is returned through it.
+	Words read with PIO are summed as they are moved, while the words transferred with DMA are summed in a single pass afterwards. */
+static inline void CopyFromFIFO(volatile u8 *smap_regbase, void *buffer, unsigned int length, u16 RxBdPtr, unsigned int capacity, unsigned int PadMin, u32 *sum){
+	unsigned int i, TransferLength;
+	int result;
+	u32 word, acc;
 
 	SMAP_REG16(SMAP_R_RXFIFO_RD_PTR)=RxBdPtr;
 
-	if((result=SmapDmaTransfer(smap_regbase, buffer, length, DMAC_TO_MEM))<0){
+	/*	Non-Sony: if the frame is at least PadMin bytes long and the buffer has enough slack, read past the end of the frame,
+		so that the whole frame is transferred with DMA instead of leaving its tail to PIO.
+		The caller only allows this when another frame of at least one DMA block follows this one in the Rx FIFO. The bytes read past the end then belong to that frame (or to the gap before it).
+		After the last frame, they would not have been written by the EMAC3 yet, and it is not known whether the DMA transfer completes
+		(instead of stalling Dev9PostDmaCbHandler()) when it reads past the write pointer. */
+	TransferLength=length;
+	if(PadMin!=0 && length>=PadMin && SmapDmaRoundUp(length)<=capacity){
+		TransferLength=SmapDmaRoundUp(length);
+	}
+
+	if((result=SmapDmaTransfer(smap_regbase, buffer, TransferLength, DMAC_TO_MEM))<0){
 		result=0;
 	}
+	SmapDriverData.RuntimeStats.RxFifoByteCount+=TransferLength;
+	SmapDriverData.RuntimeStats.RxDmaByteCount+=result;
 
-	if(result<length){
-		for(i=result; i<length; i+=4){
+	if(sum==NULL){
+		for(i=result; i<TransferLength; i+=4){
 			((u32*)buffer)[i/4]=SMAP_REG32(SMAP_R_RXFIFO_DATA);
 		}
 	}
+	else{
+		acc=0;
+		for(i=0; i<(unsigned int)result && i<length; i+=4){
+			word=((u32*)buffer)[i/4];
+			acc+=(word&0xFFFF)+(word>>16);
+		}
+		for(i=result; i<TransferLength; i+=4){
+			word=SMAP_REG32(SMAP_R_RXFIFO_DATA);
+			((u32*)buffer)[i/4]=word;
+			if(i<length) acc+=(word&0xFFFF)+(word>>16);
+		}
+		*sum=acc;
+	}
 }
 
-static inline void CopyToFIFO(volatile u8 *smap_regbase, const void *buffer, unsigned int length){
-	int i, result;
+/*	Non-Sony: early Rx filter. Only the header words that the rules need are read from the Rx FIFO with PIO, before a buffer is allocated for the frame.
+	Returns non-zero if the frame is to be dropped.	*/
+#define SMAP_RX_FILTER_HEADER_WORDS	((14+60+4+3)/4)	//Ethernet header, IPv4 header with options and the ports.
 
-	if((result=SmapDmaTransfer(smap_regbase, (void*)buffer, length, DMAC_FROM_MEM))<0){
-		result=0;
+static inline unsigned int SMapRxFilterFetch(volatile u8 *smap_regbase, u32 *header, unsigned int NumWords, unsigned int length){
+	for(; NumWords*4<length; NumWords++)
+		header[NumWords]=SMAP_REG32(SMAP_R_RXFIFO_DATA);
+
+	return NumWords;
+}
+
+static int SMapRxFilterCheck(struct SmapDriverData *SmapDrivPrivData, u16 pointer, unsigned int length){
+	volatile u8 *smap_regbase;
+	const struct SmapRxFilterRule *rule;
+	u32 header[SMAP_RX_FILTER_HEADER_WORDS];
+	const u8 *frame;
+	unsigned int i, NumWords, IPHeaderLength, DstClass, IsIPv4, HasPorts;
+	u32 DstAddr;
+	u16 EtherType, DstPort;
+
+	if(length<14)
+		return 0;
+
+	smap_regbase=SmapDrivPrivData->smap_regbase;
+	frame=(const u8*)header;
+
+	SMAP_REG16(SMAP_R_RXFIFO_RD_PTR)=pointer;
+	NumWords=SMapRxFilterFetch(smap_regbase, header, 0, 14);
+
+	EtherType=frame[12]<<8|frame[13];
+	if((frame[0]&frame[1]&frame[2]&frame[3]&frame[4]&frame[5])==0xFF)
+		DstClass=SMAP_RX_FILTER_BROADCAST;
+	else if(frame[0]&1)
+		DstClass=SMAP_RX_FILTER_MULTICAST;
+	else
+		DstClass=SMAP_RX_FILTER_UNICAST;
+
+	IsIPv4=0;
+	HasPorts=0;
+	DstAddr=0;
+	DstPort=0;
+	if((SmapDrivPrivData->RxFilterFields&SMAP_RX_FILTER_IP_FIELDS) && EtherType==0x0800 && length>=14+20){
+		NumWords=SMapRxFilterFetch(smap_regbase, header, NumWords, 14+20);
+		IPHeaderLength=(frame[14]&0xF)*4;
+		if((frame[14]>>4)==4 && IPHeaderLength>=20 && 14+IPHeaderLength<=length){
+			IsIPv4=1;
+			DstAddr=frame[14+16]<<24|frame[14+17]<<16|frame[14+18]<<8|frame[14+19];
+
+			//Only the first fragment carries the ports.
+			if((frame[14+9]==6 || frame[14+9]==17) && (frame[14+6]&0x1F)==0 && frame[14+7]==0 && 14+IPHeaderLength+4<=length){
+				NumWords=SMapRxFilterFetch(smap_regbase, header, NumWords, 14+IPHeaderLength+4);
+				HasPorts=1;
+				DstPort=frame[14+IPHeaderLength+2]<<8|frame[14+IPHeaderLength+3];
+			}
+		}
+	}
+
+	SmapDrivPrivData->RuntimeStats.RxBusReadCount+=NumWords;
+
+	for(i=0; i<SMAP_RX_FILTER_MAX; i++){
+		rule=&SmapDrivPrivData->RxFilter[i];
+		if(rule->action==SMAP_RX_FILTER_NONE) continue;
+
+		if((rule->fields&SMAP_RX_FILTER_ETHERTYPE) && rule->EtherType!=EtherType) continue;
+		if((rule->fields&SMAP_RX_FILTER_DST_CLASS) && !(rule->DstClass&DstClass)) continue;
+		if(rule->fields&SMAP_RX_FILTER_IP_FIELDS){
+			if(!IsIPv4) continue;
+			if((rule->fields&SMAP_RX_FILTER_IP_PROTO) && rule->IPProtocol!=frame[14+9]) continue;
+			if((rule->fields&SMAP_RX_FILTER_IP_DST) && (DstAddr&rule->DstMask)!=rule->DstAddr) continue;
+			if((rule->fields&SMAP_RX_FILTER_DST_PORT) && (!HasPorts || DstPort<rule->DstPortMin || DstPort>rule->DstPortMax)) continue;
+		}
+
+		SmapDrivPrivData->RxFilterHits[i]++;
+		return(rule->action==SMAP_RX_FILTER_DROP);
+	}
+
+	return 0;
+}
+
+int SMapRxFilterSet(unsigned int index, const struct SmapRxFilterRule *rule){
+	struct SmapDriverData *SmapDrivPrivData;
+	unsigned int i, count, fields;
+	int OldState;
+
+	if(index>=SMAP_RX_FILTER_MAX) return -EINVAL;
+	if(rule!=NULL && rule->action!=SMAP_RX_FILTER_ACCEPT && rule->action!=SMAP_RX_FILTER_DROP) return -EINVAL;
+
+	SmapDrivPrivData=&SmapDriverData;
+
+	//The rules are read by the interrupt handler thread without locking, so make the update appear at once.
+	CpuSuspendIntr(&OldState);
+
+	if(rule!=NULL)
+		SmapDrivPrivData->RxFilter[index]=*rule;
+	else
+		SmapDrivPrivData->RxFilter[index].action=SMAP_RX_FILTER_NONE;
+	SmapDrivPrivData->RxFilterHits[index]=0;
+
+	for(i=0,count=0,fields=0; i<SMAP_RX_FILTER_MAX; i++){
+		if(SmapDrivPrivData->RxFilter[i].action!=SMAP_RX_FILTER_NONE){
+			count++;
+			fields|=SmapDrivPrivData->RxFilter[i].fields;
+		}
+	}
+	SmapDrivPrivData->RxFilterCount=count;
+	SmapDrivPrivData->RxFilterFields=fields;
+
+	CpuResumeIntr(OldState);
+
+	return 0;
+}
+
+u32 SMapRxFilterGetHits(unsigned int index){
+	return(index<SMAP_RX_FILTER_MAX ? SmapDriverData.RxFilterHits[index] : 0);
+}
+
+void SMapRxFilterClear(void){
+	unsigned int i;
+
+	for(i=0; i<SMAP_RX_FILTER_MAX; i++)
+		SMapRxFilterSet(i, NULL);
+}
+
+/*	Non-Sony: Rx checksum verification, using the sum of the frame that was calculated by CopyFromFIFO().
+	Sums are kept in the byte order of the IOP, which is fine for a ones'-complement sum as long as the result is compared against 0xFFFF.
+	A byte at an odd offset of the frame is the upper half of a 16-bit word. */
+static inline u32 SMapCsumFold(u32 sum){
+	sum=(sum&0xFFFF)+(sum>>16);
+	return (sum&0xFFFF)+(sum>>16);
+}
+
+static u32 SMapCsumBytes(const u8 *frame, unsigned int start, unsigned int end){
+	u32 sum;
+
+	for(sum=0; start<end; start++)
+		sum+=(u32)frame[start]<<((start&1)*8);
+
+	return sum;
+}
+
+/*	Verifies the IPv4 header checksum and the TCP checksum.
+	The stack is told not to verify these checksums again (see SMapIFInit()), so every IPv4 frame that would reach its IP or TCP layer
+	without having been verified here has to be dropped: malformed IPv4 headers and fragments of TCP segments.
+	Returns 0 if the frame may be passed on, or -1 if it has to be dropped.	*/
+static int SMapRxChecksumCheck(struct SmapDriverData *SmapDrivPrivData, const u8 *frame, unsigned int length, u32 FrameSum){
+	unsigned int IPHeaderLength, TotalLength, TCPLength;
+	u32 sum;
+
+	if(length < 14 + 20 || frame[12] != 0x08 || frame[13] != 0x00 || (frame[14] >> 4) != 4)	//IPv4
+		return 0;	//No checksum to verify. The IP layer of the stack drops runts and other versions by itself.
+
+	IPHeaderLength = (frame[14] & 0xF) * 4;
+	TotalLength = frame[14 + 2] << 8 | frame[14 + 3];
+	if(IPHeaderLength < 20 || TotalLength < IPHeaderLength || 14 + TotalLength > length){
+		//Malformed: the header checksum cannot be verified.
+		SmapDrivPrivData->RuntimeStats.RxCsumBadCount++;
+		return -1;
+	}
+
+	if(SMapCsumFold(SMapCsumBytes(frame, 14, 14 + IPHeaderLength)) != 0xFFFF){
+		SmapDrivPrivData->RuntimeStats.RxCsumBadCount++;
+		return -1;
+	}
+
+	if(frame[14 + 9] != 6)	//TCP
+		return 0;
+
+	/*	The TCP checksum covers the whole datagram, so it cannot be verified for a fragment, and the stack would not verify it after reassembly.
+		TCP avoids fragmentation with its MSS and path MTU discovery, so such fragments are rare. */
+	if((frame[14 + 6] & 0x3F) != 0 || frame[14 + 7] != 0){
+		SmapDrivPrivData->RuntimeStats.RxCsumFragDropCount++;
+		return -1;
+	}
+
+	//Take the Ethernet and IP headers and anything after the datagram out of the sum of the frame, then add the pseudo header.
+	TCPLength = TotalLength - IPHeaderLength;
+	sum = SMapCsumFold(FrameSum);
+	sum += ~SMapCsumFold(SMapCsumBytes(frame, 0, 14 + IPHeaderLength)) & 0xFFFF;
+	sum += ~SMapCsumFold(SMapCsumBytes(frame, 14 + TotalLength, (length + 3) & ~3)) & 0xFFFF;
+	sum += SMapCsumBytes(frame, 14 + 12, 14 + 20);	//Source and destination addresses
+	sum += 6 << 8;	//Protocol (TCP)
+	sum += (TCPLength >> 8) | (TCPLength & 0xFF) << 8;
+
+	if(SMapCsumFold(sum) != 0xFFFF){
+		SmapDrivPrivData->RuntimeStats.RxCsumBadCount++;
+		return -1;
+	}
+
+	SmapDrivPrivData->RuntimeStats.RxCsumOkCount++;
+	return 0;
+}
+
+/*	Non-Sony: writes every segment of a pbuf chain into the Tx FIFO.
+	The Tx FIFO is written one 32-bit word at a time, so bytes left over at the end of a segment are held in a carry-over word,
+	which is completed with the first bytes of the next segment. Word-aligned segments are transferred with DMA.
+	A segment that is not word-aligned, or that the carry-over word has left unaligned (e.g. the payload after the 54-byte header of a TCP segment),
+	is copied into a word-aligned bounce buffer first if it is long enough for DMA. Shorter segments are written with PIO.
+	The last word of the frame is padded with zeros.
+
+	If the frame is at least PadMin bytes long and its last segment can be transferred with DMA, that segment is padded to a whole number of DMA blocks.
+	This reads up to one DMA block past the end of the segment (harmless in IOP RAM) and writes them into the Tx FIFO, where the EMAC3 will ignore them
+	as the BD only specifies the real length of the frame.
+	Returns the number of bytes written into the Tx FIFO. */
+static u32 TxBounceBuffer[SMAP_RX_BUFFER_SIZE/4];	//Only used by the owner of the Tx path. Holds the longest segment, padded to whole DMA blocks.
+
+static inline unsigned int CopyToFIFO(volatile u8 *smap_regbase, struct pbuf *pbuf, unsigned int PadMin){
+	unsigned int i, length, CarryLength, written, DmaWritten;
+	const u8 *data;
+	int result, pad;
+	u32 carry;
+
+	pad=(PadMin!=0 && pbuf->tot_len>=PadMin);
+	written=0;
+	DmaWritten=0;
+	carry=0;
+	CarryLength=0;
+	for(; pbuf!=NULL; pbuf=pbuf->next){
+		data=pbuf->payload;
+		length=pbuf->len;
+
+		if(CarryLength>0){
+			for(; CarryLength<4 && length>0; CarryLength++,length--)
+				carry|=(u32)(*data++)<<(CarryLength*8);
+
+			if(CarryLength<4) continue;
+
+			SMAP_REG32(SMAP_R_TXFIFO_DATA)=carry;
+			written+=4;
+			carry=0;
+			CarryLength=0;
+		}
+
+		if(((unsigned long)data&3)!=0 && length>=SmapDriverData.DmaMin && length<=SMAP_RX_FRAME_MAX){
+			memcpy(TxBounceBuffer, data, length);
+			data=(const u8*)TxBounceBuffer;
+		}
+
+		if(((unsigned long)data&3)==0){
+			if(pad && pbuf->next==NULL && length>0){
+				if((result=SmapDmaTransfer(smap_regbase, (void*)data, SmapDmaRoundUp(length), DMAC_FROM_MEM))>0){
+					written+=result;
+					DmaWritten+=result;
+					break;
+				}
+			}
+
+			if((result=SmapDmaTransfer(smap_regbase, (void*)data, length, DMAC_FROM_MEM))<0){
+				result=0;
+			}
+			DmaWritten+=result;
+
+			for(i=result; i+4<=length; i+=4){
+				SMAP_REG32(SMAP_R_TXFIFO_DATA)=((const u32*)data)[i/4];
+			}
+		}
+		else{
+			for(i=0; i+4<=length; i+=4){
+				SMAP_REG32(SMAP_R_TXFIFO_DATA)=data[i]|data[i+1]<<8|data[i+2]<<16|(u32)data[i+3]<<24;
+			}
+		}
+		written+=i&~3;
+
+		for(; i<length; i++,CarryLength++)
+			carry|=(u32)data[i]<<(CarryLength*8);
+	}
+
+	if(CarryLength>0){
+		SMAP_REG32(SMAP_R_TXFIFO_DATA)=carry;
+		written+=4;
+	}
+
+	SmapDriverData.RuntimeStats.TxFifoByteCount+=written;
+	SmapDriverData.RuntimeStats.TxDmaByteCount+=DmaWritten;
+
+	return written;
+}
+
+/*	Non-Sony: Rx buffers are taken from a ring of pre-allocated PBUF_POOL buffers, so that pbuf_alloc() is not called while the Rx FIFO is filling up.
+	The payload of a PBUF_POOL buffer is word-aligned, which is all that the DEV9 DMA channel requires.
+	If the ring has run dry (or the frame does not fit), fall back to allocating a buffer on the spot.
+	CopyFromFIFO() needs a contiguous buffer, so a buffer that ps2ip had to chain is rejected. The frame is then dropped as if the allocation had failed.
+	Ring buffers are checked in the same way by SMapRxRingRefill(), so the buffer returned is always a single pbuf. HandleRxIntr() relies on this.
+	capacity returns the number of bytes that may be written into the buffer, including any slack for over-reading the Rx FIFO. */
+static inline struct pbuf *SMapRxBufferGet(struct SmapDriverData *SmapDrivPrivData, u16 LengthRounded, unsigned int *capacity){
+	struct pbuf *pbuf;
+
+	if(LengthRounded <= SMAP_RX_FRAME_MAX && SmapDrivPrivData->RxRingIndex != SmapDrivPrivData->RxRingFillIndex){
+		pbuf = SmapDrivPrivData->RxRing[SmapDrivPrivData->RxRingIndex % SMAP_RX_RING_SIZE];
+		SmapDrivPrivData->RxRing[SmapDrivPrivData->RxRingIndex % SMAP_RX_RING_SIZE] = NULL;
+		SmapDrivPrivData->RxRingIndex++;
+
+		pbuf_realloc(pbuf, LengthRounded);
+		*capacity = SmapDrivPrivData->RxDmaPadMin != 0 ? SMAP_RX_BUFFER_SIZE : SMAP_RX_FRAME_MAX;
+	} else {
+		SmapDrivPrivData->RuntimeStats.RxRingEmpty++;
+		if((pbuf = pbuf_alloc(PBUF_RAW, LengthRounded, PBUF_POOL)) != NULL){
+			if(pbuf->next != NULL){
+				pbuf_free(pbuf);
+				return NULL;
+			}
+			*capacity = pbuf->len;
+		}
+	}
+
+	return pbuf;
+}
+
+//Tops up the Rx ring. Called by the interrupt handler thread after it has finished with the hardware.
+void SMapRxRingRefill(struct SmapDriverData *SmapDrivPrivData){
+	struct pbuf *pbuf;
+
+	while(!SmapDrivPrivData->RxRingDisabled && (unsigned char)(SmapDrivPrivData->RxRingFillIndex - SmapDrivPrivData->RxRingIndex) < SMAP_RX_RING_SIZE){
+		if((pbuf = pbuf_alloc(PBUF_RAW, SmapDrivPrivData->RxDmaPadMin != 0 ? SMAP_RX_BUFFER_SIZE : SMAP_RX_FRAME_MAX, PBUF_POOL)) == NULL)
+			break;	//Try again on the next pass.
+
+		if(pbuf->next != NULL){
+			//PBUF_POOL_BUFSIZE of ps2ip is too small, so the buffer was chained.
+			pbuf_free(pbuf);
+			if(SmapDrivPrivData->RxDmaPadMin != 0){
+				//Give up on over-reading, which needs slack after the frame, and try again without it.
+				SmapDrivPrivData->RxDmaPadMin = 0;
+				continue;
+			}
+
+			//Not even a whole frame fits. Stop using the ring for good, instead of allocating again on every pass.
+			SmapDrivPrivData->RxRingDisabled = 1;
+			break;
+		}
+
+		SmapDrivPrivData->RxRing[SmapDrivPrivData->RxRingFillIndex % SMAP_RX_RING_SIZE] = pbuf;
+		SmapDrivPrivData->RxRingFillIndex++;
 	}
+}
 
-	for(i=result; i<length; i+=4){
-		SMAP_REG32(SMAP_R_TXFIFO_DATA)=((u32*)buffer)[i/4];
+//Returns all pre-allocated Rx buffers to ps2ip.
+void SMapRxRingFlush(struct SmapDriverData *SmapDrivPrivData){
+	struct pbuf *pbuf;
+
+	while(SmapDrivPrivData->RxRingIndex != SmapDrivPrivData->RxRingFillIndex){
+		pbuf = SmapDrivPrivData->RxRing[SmapDrivPrivData->RxRingIndex % SMAP_RX_RING_SIZE];
+		SmapDrivPrivData->RxRing[SmapDrivPrivData->RxRingIndex % SMAP_RX_RING_SIZE] = NULL;
+		SmapDrivPrivData->RxRingIndex++;
+		pbuf_free(pbuf);
 	}
 }
 
-int HandleRxIntr(struct SmapDriverData *SmapDrivPrivData){
+//Drains up to budget frames from the Rx FIFO. A budget of 0 means that there is no limit.
+int HandleRxIntr(struct SmapDriverData *SmapDrivPrivData, unsigned int budget){
 	USE_SMAP_RX_BD;
 	int NumPacketsReceived, i;
 	volatile smap_bd_t *PktBdPtr;
 	volatile u8 *smap_regbase;
-	struct pbuf* pbuf;
+	struct pbuf *pbuf, *RxHead, *RxTail;
 	u16 ctrl_stat, length, pointer, LengthRounded;
+	unsigned int capacity, FrameCount, PadMin;
+	u32 FrameSum, ByteCount, sec, usec;
+	iop_sys_clock_t now;
 
 	smap_regbase=SmapDrivPrivData->smap_regbase;
 
 	NumPacketsReceived=0;
+	ByteCount=0;
+	RxHead=RxTail=NULL;
 
 	/*	Non-Sony: Workaround for the hardware BUG whereby the Rx FIFO of the MAL becomes unresponsive or loses frames when under load.
-		Check that there are frames to process, before accessing the BD registers. */
-	while(SMAP_REG8(SMAP_R_RXFIFO_FRAME_CNT) > 0){
+		Check that there are frames to process, before accessing the BD registers.
+		Reads across the DEV9 bus are slow, so the frame count is only read once per pass. Frames received in the meantime are left to the next pass. */
+	FrameCount = SMAP_REG8(SMAP_R_RXFIFO_FRAME_CNT);
+	SmapDrivPrivData->RuntimeStats.RxBusReadCount++;
+	while(FrameCount > 0 && (budget == 0 || (unsigned int)NumPacketsReceived < budget)){
 		PktBdPtr = &rx_bd[SmapDrivPrivData->RxBDIndex % SMAP_BD_MAX_ENTRY];
 		ctrl_stat = PktBdPtr->ctrl_stat;
+		SmapDrivPrivData->RuntimeStats.RxBusReadCount++;
 		if(!(ctrl_stat & SMAP_BD_RX_EMPTY)){
 			length = PktBdPtr->length;
 			LengthRounded = (length + 3) & ~3;
+			SmapDrivPrivData->RuntimeStats.RxBusReadCount++;
+			SMAP_TRACE_POINT(SMAP_TRACE_RX_BD, length);
+			/*	The position of the frame is always taken from its BD. Frames are not guaranteed to be stored back-to-back
+				(e.g. after an overrun), and copying from a guessed position would corrupt every frame after it without notice. */
 			pointer = PktBdPtr->pointer;
+			SmapDrivPrivData->RuntimeStats.RxBusReadCount++;
+
 			if(ctrl_stat&(SMAP_BD_RX_INRANGE|SMAP_BD_RX_OUTRANGE|SMAP_BD_RX_FRMTOOLONG|SMAP_BD_RX_BADFCS|SMAP_BD_RX_ALIGNERR|SMAP_BD_RX_SHORTEVNT|SMAP_BD_RX_RUNTFRM|SMAP_BD_RX_OVERRUN)){
 				for(i=0; i < 16; i++)
 					if((ctrl_stat>>i) & 1) SmapDrivPrivData->RuntimeStats.RxErrorCount++;
@@ -104,14 +507,45 @@ int HandleRxIntr(struct SmapDriverData *SmapDrivPrivData){
 				//Original did this whenever a frame is dropped.
 				SMAP_REG16(SMAP_R_RXFIFO_RD_PTR) = pointer + LengthRounded;
 			}
+			else if(ctrl_stat&SMAP_BD_RX_PFRM){
+				//Non-Sony: MAC control frames are meant for the EMAC3, not the stack.
+				SmapDrivPrivData->RuntimeStats.RxPauseFrameDropCount++;
+				SMAP_REG16(SMAP_R_RXFIFO_RD_PTR) = pointer + LengthRounded;
+			}
+			else if(SmapDrivPrivData->RxFilterCount>0 && SMapRxFilterCheck(SmapDrivPrivData, pointer, length)){
+				SmapDrivPrivData->RuntimeStats.RxFilterDropCount++;
+				SMAP_REG16(SMAP_R_RXFIFO_RD_PTR) = pointer + LengthRounded;
+			}
 			else{
-				if((pbuf=pbuf_alloc(PBUF_RAW, LengthRounded, PBUF_POOL))!=NULL){
-					CopyFromFIFO(SmapDrivPrivData->smap_regbase, pbuf->payload, length, pointer);
-
-					//Inform ps2ip that we've received data.
-					SMapLowLevelInput(pbuf);
-
-					NumPacketsReceived++;
+				if((pbuf=SMapRxBufferGet(SmapDrivPrivData, LengthRounded, &capacity))!=NULL){
+					/*	Non-Sony: the padding is less than one DMA block long, so it stays within the FIFO space used by the frames stored so far
+						only if the next frame is at least one DMA block long. The next BD is only read if the padding would be used. */
+					PadMin = 0;
+					if(FrameCount > 1 && SmapDrivPrivData->RxDmaPadMin != 0 && length >= SmapDrivPrivData->RxDmaPadMin){
+						SmapDrivPrivData->RuntimeStats.RxBusReadCount++;
+						if(rx_bd[(SmapDrivPrivData->RxBDIndex + 1) % SMAP_BD_MAX_ENTRY].length >= (1 << SmapDrivPrivData->DmaSliceShift))
+							PadMin = SmapDrivPrivData->RxDmaPadMin;
+					}
+					CopyFromFIFO(SmapDrivPrivData->smap_regbase, pbuf->payload, length, pointer, capacity, PadMin, SmapDrivPrivData->EnableRxChecksum ? &FrameSum : NULL);
+
+					if(SmapDrivPrivData->EnableRxChecksum && SMapRxChecksumCheck(SmapDrivPrivData, pbuf->payload, length, FrameSum) != 0){
+						SmapDrivPrivData->RuntimeStats.RxDroppedFrameCount++;
+						pbuf_free(pbuf);
+					} else {
+						/*	Queue the frame, to be handed over to ps2ip together with the rest of this pass.
+							The frames are linked through their next fields. This is only possible because SMapRxBufferGet() never returns a chained buffer,
+							whose own next field would otherwise be overwritten here. */
+						pbuf->next = NULL;
+						if(RxTail != NULL)
+							RxTail->next = pbuf;
+						else
+							RxHead = pbuf;
+						RxTail = pbuf;
+
+						NumPacketsReceived++;
+						ByteCount += length;
+						SmapDrivPrivData->RuntimeStats.RxFrameSizeHist[SMapStatsBucket(length>>6, SMAP_STATS_SIZE_BUCKETS)]++;
+					}
 				} else {
 					SmapDrivPrivData->RuntimeStats.RxAllocFail++;
 					//Original did this whenever a frame is dropped.
@@ -122,57 +556,195 @@ int HandleRxIntr(struct SmapDriverData *SmapDrivPrivData){
 			SMAP_REG8(SMAP_R_RXFIFO_FRAME_DEC)=0;
 			PktBdPtr->ctrl_stat=SMAP_BD_RX_EMPTY;
 			SmapDrivPrivData->RxBDIndex++;
+			FrameCount--;
 		}
 		else break;
 	}
 
+	if(RxHead != NULL){
+		//Inform ps2ip that we've received data.
+		SMAP_TRACE_POINT(SMAP_TRACE_RX_HANDOFF, NumPacketsReceived);
+		if(SMapLowLevelInput(RxHead) == 0){
+			SmapDrivPrivData->RuntimeStats.RxFrameCount += NumPacketsReceived;
+			SmapDrivPrivData->RuntimeStats.RxByteCount += ByteCount;
+			//Non-Sony: time from the wakeup of the driver thread by an interrupt to the delivery of the first frames after it.
+			if(SmapDrivPrivData->WakeupTimeValid){
+				SmapDrivPrivData->WakeupTimeValid = 0;
+				GetSystemTime(&now);
+				now.lo -= SmapDrivPrivData->WakeupTime.lo;
+				now.hi = 0;
+				SysClock2USec(&now, &sec, &usec);
+				SmapDrivPrivData->RuntimeStats.RxLatencyHist[SMapStatsBucket(sec*1000000+usec, SMAP_STATS_LATENCY_BUCKETS)]++;
+			}
+			SmapDrivPrivData->RuntimeStats.RxBatchCount++;
+			SmapDrivPrivData->RuntimeStats.RxBatchFrameCount += NumPacketsReceived;
+			if(NumPacketsReceived > SmapDrivPrivData->RuntimeStats.RxBatchMax)
+				SmapDrivPrivData->RuntimeStats.RxBatchMax = NumPacketsReceived;
+		} else
+			SmapDrivPrivData->RuntimeStats.RxDroppedFrameCount += NumPacketsReceived;
+	}
+
 	return NumPacketsReceived;
 }
 
-int HandleTxReqs(struct SmapDriverData *SmapDrivPrivData){
-	int result, length;
-	void *data;
+/*	Copies one frame into the Tx FIFO and sets up its BD. The caller must own the Tx path (see SMapTxTryLock()).
+	Returns 1 if the frame was written, or 0 if there is no free BD or insufficient FIFO space. */
+int SMapTransmitFrame(struct SmapDriverData *SmapDrivPrivData, struct pbuf *pbuf, int length){
 	USE_SMAP_TX_BD;
 	volatile u8 *smap_regbase;
 	volatile smap_bd_t *BD_ptr;
 	u16 BD_data_ptr;
-	unsigned int SizeRounded;
+	unsigned int SizeRounded, written;
+
+	if(SmapDrivPrivData->NumPacketsInTx < SMAP_BD_MAX_ENTRY){
+		SizeRounded = (length+3)&~3;
+		//If the frame may be padded for DMA, reserve enough space for the padding of its last segment.
+		if(SmapDrivPrivData->TxDmaPadMin != 0 && length >= SmapDrivPrivData->TxDmaPadMin)
+			SizeRounded += 1<<SmapDrivPrivData->DmaSliceShift;
+
+		if(SmapDrivPrivData->TxBufferSpaceAvailable >= SizeRounded){
+			smap_regbase=SmapDrivPrivData->smap_regbase;
+
+			//Non-Sony: the write pointer is tracked locally, instead of being read across the DEV9 bus.
+			BD_data_ptr=SmapDrivPrivData->TxFifoWrPtr + SMAP_TX_BASE;
+			BD_ptr=&tx_bd[SmapDrivPrivData->TxBDIndex % SMAP_BD_MAX_ENTRY];
+
+			written=CopyToFIFO(SmapDrivPrivData->smap_regbase, pbuf, SmapDrivPrivData->TxDmaPadMin);
+
+			BD_ptr->length=length;
+			BD_ptr->pointer=BD_data_ptr;
+			SMAP_REG8(SMAP_R_TXFIFO_FRAME_INC)=0;
+			BD_ptr->ctrl_stat=SMAP_BD_TX_READY|SMAP_BD_TX_GENFCS|SMAP_BD_TX_GENPAD;
+			SMAP_TRACE_POINT(SMAP_TRACE_TX_ARM, length);
+			SmapDrivPrivData->RuntimeStats.TxByteCount+=length;
+			SmapDrivPrivData->RuntimeStats.TxFrameSizeHist[SMapStatsBucket(length>>6, SMAP_STATS_SIZE_BUCKETS)]++;
+			SmapDrivPrivData->TxBDSize[SmapDrivPrivData->TxBDIndex % SMAP_BD_MAX_ENTRY]=written;
+			SmapDrivPrivData->TxBDIndex++;
+			SmapDrivPrivData->NumPacketsInTx++;
+			SmapDrivPrivData->TxBufferSpaceAvailable-=written;
+			SmapDrivPrivData->TxFifoWrPtr=(SmapDrivPrivData->TxFifoWrPtr+written)%SMAP_TX_BUFSIZE;
+
+			return 1;
+		}
+		else return 0;	//Out of FIFO space
+	}
+	else return 0;	//Queue full
+}
+
+int HandleTxReqs(struct SmapDriverData *SmapDrivPrivData){
+	int result, length;
+	struct pbuf *pbuf;
 
 	result=0;
 	while(1){
-		if((length = SMapTxPacketNext(&data)) < 1){
+		if((length = SMapTxPacketNext(&pbuf)) < 1){
 			return result;
 		}
-		SmapDrivPrivData->packetToSend = data;
+		SmapDrivPrivData->packetToSend = pbuf;
 
-		if(SmapDrivPrivData->NumPacketsInTx < SMAP_BD_MAX_ENTRY){
-			if(length > 0){
-				SizeRounded = (length+3)&~3;
+		if(SMapTransmitFrame(SmapDrivPrivData, pbuf, length))
+			result++;
+		else
+			return result;
 
-				if(SmapDrivPrivData->TxBufferSpaceAvailable >= SizeRounded){
-					smap_regbase=SmapDrivPrivData->smap_regbase;
+		SmapDrivPrivData->packetToSend = NULL;
+		SMapTxPacketDeQ();
+	}
+}
 
-					BD_data_ptr=SMAP_REG16(SMAP_R_TXFIFO_WR_PTR) + SMAP_TX_BASE;
-					BD_ptr=&tx_bd[SmapDrivPrivData->TxBDIndex % SMAP_BD_MAX_ENTRY];
+/*	Non-Sony: DMA calibration.
+	The time taken to write into the Tx FIFO is measured with PIO and with every DMA block size, which reflects the speed of the DEV9 bus of this console.
+	The Tx FIFO is used because it can be filled without a link or a peer. It is reset before every run and once more at the end,
+	so calibration must be done before the Tx FIFO is in use.	*/
+#define SMAP_CALIBRATE_SIZE	1024	//Largest transfer timed, in bytes. Must fit into the Tx FIFO.
+#define SMAP_CALIBRATE_RUNS	16
 
-					CopyToFIFO(SmapDrivPrivData->smap_regbase, data, length);
+static int SMapTxFifoReset(volatile u8 *smap_regbase){
+	int i;
 
-					result++;
-					BD_ptr->length=length;
-					BD_ptr->pointer=BD_data_ptr;
-					SMAP_REG8(SMAP_R_TXFIFO_FRAME_INC)=0;
-					BD_ptr->ctrl_stat=SMAP_BD_TX_READY|SMAP_BD_TX_GENFCS|SMAP_BD_TX_GENPAD;
-					SmapDrivPrivData->TxBDIndex++;
-					SmapDrivPrivData->NumPacketsInTx++;
-					SmapDrivPrivData->TxBufferSpaceAvailable-=SizeRounded;
-				}
-				else return result;	//Out of FIFO space
-			} else
-				printf("smap: dropped\n");
+	SMAP_REG8(SMAP_R_TXFIFO_CTRL)=SMAP_TXFIFO_RESET;
+	for(i=9; SMAP_REG8(SMAP_R_TXFIFO_CTRL)&SMAP_TXFIFO_RESET; i--){
+		if(i<=0) return -1;
+		DelayThread(1000);
+	}
+
+	return 0;
+}
+
+//Returns the number of system clock ticks taken to write size bytes into the Tx FIFO SMAP_CALIBRATE_RUNS times.
+static u32 SMapTimeTxFifoWrite(volatile u8 *smap_regbase, const u32 *buffer, unsigned int size, int UseDma){
+	iop_sys_clock_t start, end;
+	unsigned int run, i;
+	u32 total;
+
+	for(run=0,total=0; run<SMAP_CALIBRATE_RUNS; run++){
+		if(SMapTxFifoReset(smap_regbase)!=0) return 0xFFFFFFFF;
+
+		GetSystemTime(&start);
+		if(UseDma){
+			SmapDmaTransfer(smap_regbase, (void*)buffer, size, DMAC_FROM_MEM);
 		}
-		else return result;	//Queue full
+		else{
+			for(i=0; i<size; i+=4) SMAP_REG32(SMAP_R_TXFIFO_DATA)=buffer[i/4];
+		}
+		GetSystemTime(&end);
 
-		SmapDrivPrivData->packetToSend = NULL;
-		SMapTxPacketDeQ();
+		total+=end.lo-start.lo;
+	}
+
+	return total;
+}
+
+static u32 SMapTicksToUSec(u32 ticks){
+	iop_sys_clock_t clock;
+	u32 sec, usec;
+
+	clock.hi=0;
+	clock.lo=ticks;
+	SysClock2USec(&clock, &sec, &usec);
+
+	return sec*1000000+usec;
+}
+
+/*	Selects the DMA block size that writes SMAP_CALIBRATE_SIZE bytes the fastest,
+	then the smallest transfer (in multiples of that block size) for which DMA is faster than PIO.	*/
+int SMapDmaCalibrate(struct SmapDriverData *SmapDrivPrivData, int verbose){
+	volatile u8 *smap_regbase;
+	struct pbuf *pbuf;
+	unsigned int shift, BestShift, size;
+	u32 ticks, BestTicks, PioTicks;
+
+	smap_regbase=SmapDrivPrivData->smap_regbase;
+
+	if((pbuf=pbuf_alloc(PBUF_RAW, SMAP_CALIBRATE_SIZE, PBUF_RAM))==NULL) return -ENOMEM;
+	bzero(pbuf->payload, SMAP_CALIBRATE_SIZE);
+
+	SmapDrivPrivData->DmaMin=0;
+	BestShift=SmapDrivPrivData->DmaSliceShift;
+	BestTicks=0xFFFFFFFF;
+	for(shift=SMAP_DMA_SLICE_SHIFT_MIN; shift<=SMAP_DMA_SLICE_SHIFT_MAX; shift++){
+		SmapDrivPrivData->DmaSliceShift=shift;
+		ticks=SMapTimeTxFifoWrite(smap_regbase, pbuf->payload, SMAP_CALIBRATE_SIZE, 1);
+		if(verbose) DEBUG_PRINTF("smap: DMA, %u-byte blocks: %u bytes in %u us\n", 1<<shift, SMAP_CALIBRATE_SIZE, SMapTicksToUSec(ticks/SMAP_CALIBRATE_RUNS));
+
+		if(ticks<BestTicks){
+			BestTicks=ticks;
+			BestShift=shift;
+		}
 	}
+	SmapDrivPrivData->DmaSliceShift=BestShift;
+
+	for(size=1<<BestShift; size<=SMAP_CALIBRATE_SIZE; size<<=1){
+		PioTicks=SMapTimeTxFifoWrite(smap_regbase, pbuf->payload, size, 0);
+		ticks=SMapTimeTxFifoWrite(smap_regbase, pbuf->payload, size, 1);
+		if(verbose) DEBUG_PRINTF("smap: %u bytes: PIO %u us, DMA %u us\n", size, SMapTicksToUSec(PioTicks/SMAP_CALIBRATE_RUNS), SMapTicksToUSec(ticks/SMAP_CALIBRATE_RUNS));
+
+		if(ticks<PioTicks) break;
+	}
+	SmapDrivPrivData->DmaMin=size;
+
+	pbuf_free(pbuf);
+	SmapDrivPrivData->TxFifoWrPtr=0;
+
+	return SMapTxFifoReset(smap_regbase);
 }
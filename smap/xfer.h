@@ -1,2 +1,6 @@
-int HandleRxIntr(struct SmapDriverData *SmapDrivPrivData);
+int HandleRxIntr(struct SmapDriverData *SmapDrivPrivData, unsigned int budget);
 int HandleTxReqs(struct SmapDriverData *SmapDrivPrivData);
+int SMapTransmitFrame(struct SmapDriverData *SmapDrivPrivData, struct pbuf *pbuf, int length);
+void SMapRxRingRefill(struct SmapDriverData *SmapDrivPrivData);
+void SMapRxRingFlush(struct SmapDriverData *SmapDrivPrivData);
+int SMapDmaCalibrate(struct SmapDriverData *SmapDrivPrivData, int verbose);